@@ -11,14 +11,102 @@ ALU 実装（8bit 結果 + フラグ）
   bit4: E   (Even)
   bit5: O   (Odd)
   bit6-7: 予備
+- 処理遅延: GateALU（ゲートレベルモデル）のクリティカルパスからオペコード別に算出
+- ALU<Config>: 遅延の有無・ゲート遅延はコンフィグ型からコンパイル時に決定
+
+GateALU 実装（ビットスライス）:
+- 64個のテストベクタを uint64_t の各ビットに詰め、ゲート単位で同時に評価
+- 反転器 + キャリー入力MUX + リップルキャリー加算器 + NOR/AND/XOR/RSH 回路 + 出力MUX
+- 各信号線は到着時刻を持ち、ゲート遅延 (GateDelay) を積み上げて遅延を求める
 
 Register 実装 (Read, Write):
+- Register<Config, Count, ZeroReg>: 本数とゼロレジスタの有無はテンプレート引数で固定
+  （生成はコンストラクタで行うため、呼び出しごとの生成済みチェックは不要）
 - 関数
-  reg_create(): レジスタを新規作成
   reg_clear():  レジスタをすべて0にリセット
   reg_write():  指定レジスタにデータを書き込み
   reg_read():   指定レジスタからデータを読み出し
 
+CPU<Config> 実装:
+- ALU, 汎用レジスタ, アドレスポインタ, RAM, I/Oポート, CALstack, GPRstack をまとめたコア
+- 構成 (CPUConfig::Demo / Spec / Fast) はテンプレート引数。部品テストでは --config の名前で実行時に選択する
+  （ベンチマーク・ファジングなど他のモードは fast 構成で動き、--config fast 以外を指定するとエラー）
+
+ベンチマーク (--bench [--out FILE], --compare OLD NEW [--threshold PCT]):
+- micro: ALU::execute（オペコード別）, GateALU::evaluate, Register::reg_read / reg_write
+- decode: disassemble, read_rom（テキストの ROM を命令に戻す）
+- guest: ソート, CRC-8, ビット操作, I/O ループのゲストプログラムを CPU<Fast>::run で実行（1命令あたりの時間と MIPS）
+- macro: レジスタ読み出し → ALU → 書き戻しのループ, ゲートレベルALUの全入力照合
+- 結果は JSON で保存し、2回分を比較してしきい値を超える悪化と、なくなった項目を検出する
+  （読めない・1件も結果のないファイルはエラーで終了する）
+
+差分ファジング (--fuzz [--cases N] [--seconds S] [--seed X] [--threads T]):
+- ランダムな命令列・初期状態・入力ポートの変化を生成し、全実行エンジンで実行
+  reference: CPU<Config>, gate-level: GateALUEngine, memoized: Memoizer で CAL を省略,
+  trap: 全命令にブレークポイント（Debugger の TRAP と元の命令の実行）, multicore: 1コア・1命令の量子の MultiCore（共有 RAM への反映）
+- 基本ブロックの終端ごとにアーキテクチャ状態を比較し、食い違いがあれば命令列を自動で縮小して表示
+  （memoized は呼び出しを飛ばした分だけ先に進むので、参照と同じ命令数のときだけ比べる）
+- 縮小では命令を NOP に置き換えた後、NOP を取り除いて飛び先を付け替え、アドレスを詰める
+
+ダッシュボード (--dashboard [--fps N] [--duration S]):
+- VM は一定命令数ごとに状態を SeqLock へ書くだけで、待たずに全速で実行を続ける
+- 描画スレッドが一定のフレームレートで状態を読み、前フレームから変化したセルだけを ANSI カーソル移動で書き換える
+
+MultiCore<Config> 実装 (--multicore [--cores N] [--quantum Q] [--mem-latency L] [--threads T]):
+- コアごとにレジスタ・ap・スタックを持ち、RAM と I/O ポートを共有する（r1 にコア番号を入れて起動）
+- 量子ごとにバリアで同期。量子の間は開始時点の共有メモリの写しに対して実行し、終わりに調停順で反映する
+  （調停の優先順位は量子ごとに巡回。ホストのスレッド数やタイミングによらず結果が再現する）
+- 同じ量子で同じアドレスに触れたコアは、調停順に mem-latency サイクルずつ待たされる（競合レポート）
+
+ホスト側の計測 (-DCPUVM_PROFILE でビルド, --profile-out FILE):
+- ALU::execute, Register::reg_read / reg_write, CPU::step, MLD/MST/PLD/PST, SeqLock::store / Dashboard::draw に
+  RDTSC のスコープタイマーを置き、スレッドごとのバッファに集計する
+- 終了時に区間ごとの回数・合計・自己時間の表を表示し、Chrome trace (chrome://tracing) の JSON を書き出す
+- CPUVM_PROFILE なしでは PROFILE_SCOPE は空になり、計測コードは残らない
+
+Memoizer<Config> 実装（純粋なサブルーチンのメモ化）:
+- CAL 先を静的に解析し、MST/PLD/PST/HLT を含まず、r1〜r4 以外のレジスタと入力フラグを
+  書く前に読まず、GPRstack の積み下ろしが釣り合い、呼び出し先も純粋なものを「純粋」とみなす（ZPPv2 §7.2）
+  （PSH rn … POP rn で呼び出し元の値を戻す Callee-Saved の退避は、読み出しにも書き込みにも数えない）
+- MLD（表引き）は読んでよい。呼び出し元で設定されたままのアドレスレジスタを使うなら、その値もキーに加える
+- Debugger がブレークポイントで ROM を書き換えると、解析結果と記録した結果をすべて捨てる
+- (呼び出し先, r1〜r4) -> (書いたレジスタと r15・アドレスレジスタ, フラグ, 命令数, 読んだ RAM のアドレス) を
+  上限つきのハッシュ表に記録し、ヒットしたら実行を省略する
+  （命令数は retired に加算し、遅延ありの構成では記録した実行時間だけ待つ）
+- 読んだアドレスは WatchTable と同じ256bitのマスクで持ち、MST がそこに書いたらその結果を捨てる
+  （reset / restore で RAM ごと置き換えたときは、RAM を読んだ結果をすべて捨てる）
+
+Superoptimizer 実装 (--superopt [--max-length N] [--rules FILE] [--threads T]):
+- 入力 r1 -> 出力 r15 の8bit関数について、ALU / ADI / SBI / ANI / LDI / MOV の命令列を短い順に全列挙
+- 途中状態は入力256通りぶんの値で持ち、最後の命令だけ32個のテストベクタで ALU<Fast>::compute を使って絞り込み、
+  残った候補を CPU で256通りすべて検証する
+  （全入力で同じ途中状態になる命令列は、短く辞書順で最初のものだけを代表として先へ伸ばす。
+   刈り込みの表は全スレッドで共有し、探索後に代表だけを通った結果を残すので、見つかる命令列は --threads によらない。
+   代表以外を経由する同じ長さの命令列は出力しないので、最短の等価な命令列すべてではない）
+- 生成器の素直な命令列より短いものを、peephole.js の PEEPHOLE_RULES 形式で出力する
+
+InputSweep<Config> 実装 (--sweep [--rom FILE] [--inputs P[,P]] [--slice BEGIN END] [--golden FILE] [--write-golden FILE] [--threads T]):
+- 入力ポート1〜2個の全組み合わせ（256 / 65536通り）か、その一部を並列に実行し、出力ポートへの書き込み列を比較する
+- 比較先は C++ の参照関数かゴールデンファイル（1行1ケース: "入力... -> ポート:値 ..."）
+- 最初の PLD の直前（_start の初期化が終わった状態）のスナップショットから各ケースを始める
+- HLT に届かなかったケース（異常停止・命令数の上限）は、そこまでの出力が一致していても食い違いとして理由とともに報告する
+- ゴールデンファイルの書式の誤りは、行番号を付けてエラーにする
+- --rom で ROM ファイル（1行1命令、disassemble と同じ表記、';' 以降はコメント）を読む。省略時はデモ用プログラム
+  （参照関数はデモ用プログラムのものなので、--rom のときはゴールデンファイルが必要。入力ポートは --inputs、既定は 0,1）
+
+分岐プロファイル (--branch-profile FILE [--rom FILE] [--inputs P[,P]] [--locations FILE] [--slice BEGIN END] [--threads T]):
+- CPU::branches に BranchProfile を設定すると、BRH ごとに成立・不成立を数える（未設定なら判定1つだけ）
+  （設定中は CPU::memo があってもメモ化した呼び出しを省略せず、呼び出し先の BRH も数える）
+- 入力スイープの全ケースを実行して合計し、コード生成器の位置表 ("pc ファイル:行:列#n/T") で Z++ のソース位置に対応づけて
+  profile.json の "branches" 形式で書き出す（既存の profile.json は "branches" だけを置き換え、"calls" などは残す）。成立の方が多い BRH には反転（前向き）か回転（後ろ向き）の候補の印を付ける（COMPILER.md §6.10）
+
+Debugger<CPUType> 実装（ブレークポイント）:
+- ブレークポイントの位置のプリデコード済み命令を TRAP に置き換え、元の命令を保存する
+- TRAP に当たったときだけ条件を評価し、再開時は元の命令を戻して1命令実行してから TRAP を書き直す
+- ブレークポイントのない命令の実行コストは変わらない
+- ウォッチポイント: RAM / ポートの読み出し・書き込み・値の変化。MLD / MST / PLD / PST は 256bit マスクのビットを1つ調べるだけ
+  当たったら pc・Z++ のソース行・変化前後の値を報告する
+
 テスト:
 - 期待出力 (ALUテスト):
   100 + 200 = 44, Flags: C=1, NC=0, Z=0, NZ=1, E=1, O=0
@@ -26,19 +114,43 @@ Register 実装 (Read, Write):
   1 - 200 = 57, Flags: C=0, NC=1, Z=0, NZ=1, E=0, O=1
   1 - 200 - 1 = 56, Flags: C=0, NC=1, Z=0, NZ=1, E=1, O=0
   ~(0b01110111 | 0b00001111) = 0b10000000 (128), Flags: C=0, NC=1, Z=0, NZ=1, E=1, O=0
-  0b10010010 & 0b01111011 = 0b00010010 (18), Flags: C=0, NC=1, Z=1, NZ=0, E=1, O=0
+  0b10010010 & 0b01111011 = 0b00010010 (18), Flags: C=0, NC=1, Z=0, NZ=1, E=1, O=0
   0b01100111 ^ 0b00110011 = 0b01010100 (84), Flags: C=0, NC=1, Z=0, NZ=1, E=1, O=0
   (0b10101010 | 0b01010101) >> 1 = 0b01111111 (127), Flags: C=0, NC=1, Z=0, NZ=1, E=0, O=1
 */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
 #include <stdexcept> // exit()で異常終了させる場合に使用
+#include <sstream>
+#include <string>
 #include <thread>
 #include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
+#ifdef CPUVM_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 // ANSI カラーコード
 namespace Colors {
@@ -50,13 +162,193 @@ namespace Colors {
   constexpr const char* DIM = "\033[2m";
 }
 
-// CPUの設定
+// ホスト側の計測（シミュレータ自身がどこで時間を使っているか）
+namespace HostProfile {
+  enum Zone : uint8_t { Dispatch, ALU, RegRead, RegWrite, IO, Trace, ZoneCount };
+
+  constexpr const char* ZoneNames[] = {"dispatch", "alu", "reg_read", "reg_write", "io", "trace"};
+
+#ifdef CPUVM_PROFILE
+  inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+  }
+
+  // trace に残す区間の上限（スレッドごと。集計はこれを超えても続ける）
+  constexpr size_t MaxEvents = size_t{1} << 20;
+
+  struct Event {
+    uint64_t start;
+    uint64_t end;
+    Zone zone;
+  };
+
+  struct ThreadBuffer {
+    uint32_t tid = 0;
+    std::array<uint64_t, ZoneCount> count{};
+    std::array<uint64_t, ZoneCount> total{}; // 子の区間を含む
+    std::array<uint64_t, ZoneCount> self{};  // 子の区間を除く
+    std::vector<Event> events;
+    uint64_t *child = nullptr; // 実行中の親区間の「子の時間」
+  };
+
+  class Registry {
+  public:
+    static Registry &instance() {
+      static Registry registry;
+      return registry;
+    }
+
+    ThreadBuffer *attach() {
+      std::lock_guard<std::mutex> lock(mutex);
+      buffers.push_back(std::make_unique<ThreadBuffer>());
+      buffers.back()->tid = static_cast<uint32_t>(buffers.size());
+      return buffers.back().get();
+    }
+
+    // 経過 tick / 経過 μs（RDTSC の周波数を実行時間から求める）
+    double ticks_per_us() const {
+      double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count();
+      return (ticks() - start_ticks) / std::max(us, 1e-9);
+    }
+
+    void print_summary() {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::array<uint64_t, ZoneCount> count{}, total{}, self{};
+      for (const auto &b : buffers) {
+        for (size_t z = 0; z < ZoneCount; ++z) {
+          count[z] += b->count[z];
+          total[z] += b->total[z];
+          self[z] += b->self[z];
+        }
+      }
+      double scale = 1000.0 / ticks_per_us(); // tick -> ns
+      std::cout << Colors::CYAN << Colors::BOLD << "\n==== HOST PROFILE (" << buffers.size() << " threads) ====" << Colors::RESET << std::endl;
+      std::cout << std::left << std::setw(12) << "zone" << std::right << std::setw(14) << "count" << std::setw(14) << "total ms"
+                << std::setw(14) << "self ms" << std::setw(12) << "ns/call" << "\n";
+      for (size_t z = 0; z < ZoneCount; ++z) {
+        std::cout << std::left << std::setw(12) << ZoneNames[z] << std::right << std::setw(14) << count[z] << std::fixed << std::setprecision(2)
+                  << std::setw(14) << total[z] * scale / 1e6 << std::setw(14) << self[z] * scale / 1e6
+                  << std::setw(12) << (count[z] ? total[z] * scale / count[z] : 0.0) << std::defaultfloat << "\n";
+      }
+    }
+
+    void write_chrome_trace(const std::string &path) {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::ofstream out(path);
+      if (!out) {
+        std::cerr << "Error: Cannot write " << path << ". Terminate." << std::endl;
+        exit(1);
+      }
+      double per_us = ticks_per_us();
+      out << "{\"traceEvents\": [\n";
+      bool first = true;
+      for (const auto &b : buffers) {
+        for (const Event &e : b->events) {
+          out << (first ? "" : ",\n") << "  {\"name\": \"" << ZoneNames[e.zone] << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b->tid
+              << std::fixed << std::setprecision(3) << ", \"ts\": " << (e.start - start_ticks) / per_us
+              << ", \"dur\": " << (e.end - e.start) / per_us << std::defaultfloat << "}";
+          first = false;
+        }
+      }
+      out << "\n], \"displayTimeUnit\": \"ns\"}\n";
+    }
+
+  private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers; // スレッド終了後も集計に使うので Registry が持つ
+    uint64_t start_ticks = ticks();
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+  };
+
+  inline ThreadBuffer &local() {
+    thread_local ThreadBuffer *buffer = Registry::instance().attach();
+    return *buffer;
+  }
+
+  class Scope {
+  public:
+    explicit Scope(Zone zone) : buffer(local()), zone(zone), parent(buffer.child), start(ticks()) {
+      buffer.child = &child;
+    }
+
+    ~Scope() {
+      uint64_t end = ticks();
+      uint64_t elapsed = end - start;
+      buffer.child = parent;
+      if (parent) {
+        *parent += elapsed;
+      }
+      ++buffer.count[zone];
+      buffer.total[zone] += elapsed;
+      buffer.self[zone] += elapsed - child;
+      if (buffer.events.size() < MaxEvents) {
+        buffer.events.push_back({start, end, zone});
+      }
+    }
+
+  private:
+    ThreadBuffer &buffer;
+    Zone zone;
+    uint64_t *parent;
+    uint64_t child = 0;
+    uint64_t start;
+  };
+#endif
+}
+
+#ifdef CPUVM_PROFILE
+#define PROFILE_SCOPE(zone) HostProfile::Scope host_profile_scope(HostProfile::zone)
+#else
+#define PROFILE_SCOPE(zone) ((void)0)
+#endif
+
+// ゲート1段あたりの伝搬遅延（秒）
+struct GateDelay {
+  double NOT;
+  double AND;
+  double OR;
+  double NOR;
+  double XOR;
+  double MUX;
+};
+
+// CPUの設定（コンフィグ型ごとに CPU<Config> をコンパイル時に特殊化する）
 namespace CPUConfig {
-  constexpr double ALUDelay = 0.8;
-  constexpr uint8_t RegCount = 8;
-  constexpr bool UseZeroReg = true;
-  constexpr double RegReadDelay = 0.3;
-  constexpr double RegWriteDelay = 0.4;
+  constexpr GateDelay ALUGateDelay = {0.02, 0.04, 0.04, 0.04, 0.06, 0.06}; // NOT, AND, OR, NOR, XOR, MUX
+
+  // 部品テスト用の構成（遅延あり, 8レジスタ）
+  struct Demo {
+    static constexpr const char* Name = "demo";
+    static constexpr uint8_t RegCount = 8;
+    static constexpr bool UseZeroReg = true;
+    static constexpr uint8_t ApCount = 16;
+    static constexpr size_t CallStackDepth = 64;
+    static constexpr size_t GPRStackDepth = 64;
+    static constexpr size_t RAMSize = 256;
+    static constexpr uint8_t PortCount = 16;
+    static constexpr bool UseDelay = true; // タイミングモデル: ゲート遅延とレジスタ遅延を待つ
+    static constexpr bool Verbose = true;  // 生成・クリア・r0書き込みを表示
+    static constexpr GateDelay ALUGateDelay = CPUConfig::ALUGateDelay;
+    static constexpr double RegReadDelay = 0.3;
+    static constexpr double RegWriteDelay = 0.4;
+  };
+
+  // CPUSPECS.md 準拠の構成（遅延あり, 16レジスタ）
+  struct Spec : Demo {
+    static constexpr const char* Name = "spec";
+    static constexpr uint8_t RegCount = 16;
+  };
+
+  // 遅延なしの構成（検証・計測用）
+  struct Fast : Spec {
+    static constexpr const char* Name = "fast";
+    static constexpr bool UseDelay = false;
+    static constexpr bool Verbose = false;
+  };
 }
 
 // オペコードの定義
@@ -71,6 +363,8 @@ enum class Opcode : uint8_t {
   RSH = 0b0111
 };
 
+constexpr const char* OpcodeNames[] = {"ADD", "ADC", "SUB", "SBC", "NOR", "AND", "XOR", "RSH"};
+
 // フラグビットのマスク定義
 namespace Flags {
   constexpr uint8_t C = 1 << 0;  // Carry
@@ -81,19 +375,183 @@ namespace Flags {
   constexpr uint8_t O = 1 << 5;  // Odd
 }
 
-// ALUクラス
-class ALU {
+// ゲートレベルALUクラス（ビットスライス）
+// uint64_t の第kビットを k 番目のテストベクタに割り当て、64ベクタを1回の評価で伝搬させる。
+class GateALU {
+public:
+  static constexpr size_t Lanes = 64;
+
+  // 信号線: 全レーンの論理値と到着時刻
+  struct Wire {
+    uint64_t v = 0;
+    double t = 0.0;
+    bool fixed = false; // オペコードから決まる制御信号（データより先に確定するため遅延0）
+  };
+
+  uint8_t result[Lanes];
+  uint8_t flags[Lanes];
+  double delay = 0.0; // 直前の評価での最大到着時刻
+
+  explicit GateALU(const GateDelay &gate_delay) : gd(gate_delay) {}
+
+  // count 個（最大64）のベクタを評価し、result/flags/delay を更新
+  void evaluate(const uint8_t *A, const uint8_t *B, const Opcode *opcodes, size_t count) {
+    Wire a[8], b[8], op[3];
+    lane_mask = (count >= Lanes) ? ~0ULL : ((1ULL << count) - 1);
+
+    // 各ベクタをビットプレーンに転置
+    for (size_t k = 0; k < count; ++k) {
+      uint8_t code = static_cast<uint8_t>(opcodes[k]);
+      for (int i = 0; i < 8; ++i) {
+        a[i].v |= static_cast<uint64_t>((A[k] >> i) & 1) << k;
+        b[i].v |= static_cast<uint64_t>((B[k] >> i) & 1) << k;
+      }
+      for (int i = 0; i < 3; ++i) {
+        op[i].v |= static_cast<uint64_t>((code >> i) & 1) << k;
+      }
+    }
+    for (Wire &w : op) {
+      w.fixed = true;
+    }
+
+    // 反転器 + キャリー入力MUX (SUB/SBC で B を反転, ADC/SUB でキャリー入力 1)
+    Wire b2[8];
+    for (int i = 0; i < 8; ++i) {
+      b2[i] = MUX(op[1], b[i], NOT(b[i]));
+    }
+    Wire carry = MUX(op[1], op[0], NOT(op[0]));
+
+    // リップルキャリー加算器
+    Wire sum[8];
+    for (int i = 0; i < 8; ++i) {
+      Wire p = XOR(a[i], b2[i]);
+      sum[i] = XOR(p, carry);
+      carry = OR(AND(a[i], b2[i]), AND(p, carry));
+    }
+
+    // 論理演算回路 (RSH は (A | B) >> 1 の配線シフト)
+    Wire nor_out[8], and_out[8], xor_out[8], rsh_out[8];
+    Wire ground = {0, 0.0, true};
+    for (int i = 0; i < 8; ++i) {
+      nor_out[i] = NOR(a[i], b[i]);
+      and_out[i] = AND(a[i], b[i]);
+      xor_out[i] = XOR(a[i], b[i]);
+      rsh_out[i] = (i < 7) ? OR(a[i + 1], b[i + 1]) : ground;
+    }
+
+    // 出力MUX (op[2]: 算術/論理, op[1..0]: 論理演算の選択)
+    Wire r[8];
+    for (int i = 0; i < 8; ++i) {
+      Wire logic = MUX(op[1], MUX(op[0], nor_out[i], and_out[i]), MUX(op[0], xor_out[i], rsh_out[i]));
+      r[i] = MUX(op[2], sum[i], logic);
+    }
+
+    // フラグ生成 (論理演算ではキャリーは発生しない)
+    Wire c_flag = AND(carry, NOT(op[2]));
+    Wire nc_flag = NOT(c_flag);
+    Wire low = OR(OR(r[0], r[1]), OR(r[2], r[3]));
+    Wire high = OR(OR(r[4], r[5]), OR(r[6], r[7]));
+    Wire z_flag = NOR(low, high);
+    Wire nz_flag = OR(low, high);
+    Wire e_flag = NOT(r[0]);
+    Wire o_flag = r[0];
+
+    const Wire *flag_wires[6] = {&c_flag, &nc_flag, &z_flag, &nz_flag, &e_flag, &o_flag};
+    delay = 0.0;
+    for (const Wire &w : r) {
+      delay = std::max(delay, w.t);
+    }
+    for (const Wire *w : flag_wires) {
+      delay = std::max(delay, w->t);
+    }
+
+    // レーンから各ベクタの結果へ戻す
+    for (size_t k = 0; k < count; ++k) {
+      result[k] = 0;
+      flags[k] = 0;
+      for (int i = 0; i < 8; ++i) {
+        result[k] |= static_cast<uint8_t>(((r[i].v >> k) & 1) << i);
+      }
+      for (int i = 0; i < 6; ++i) {
+        flags[k] |= static_cast<uint8_t>(((flag_wires[i]->v >> k) & 1) << i);
+      }
+    }
+  }
+
+  // 指定オペコードのクリティカルパス遅延（秒）
+  double op_delay(Opcode opcode) {
+    uint8_t zeros[Lanes] = {};
+    Opcode opcodes[Lanes];
+    for (Opcode &o : opcodes) {
+      o = opcode;
+    }
+    evaluate(zeros, zeros, opcodes, Lanes);
+    return delay;
+  }
+
 private:
-  bool is_setup = false;
+  GateDelay gd;
+  uint64_t lane_mask = ~0ULL;
 
-  // 初期化済みチェック
-  void ensure_setup() const {
-    if (!is_setup) {
-      std::cerr << "Error: ALU is not set up. Call alu_setup(). Terminate."  << std::endl;
-      exit(1);
+  bool all_zero(const Wire &w) const { return w.fixed && (w.v & lane_mask) == 0; }
+  bool all_one(const Wire &w) const { return w.fixed && (w.v & lane_mask) == lane_mask; }
+
+  // 入力がすべて制御信号なら出力も制御信号、それ以外は最も遅い入力 + ゲート遅延
+  Wire settle(uint64_t v, double gate_delay, const Wire &x, const Wire &y) const {
+    if (x.fixed && y.fixed) {
+      return {v, 0.0, true};
     }
+    return {v, std::max(x.t, y.t) + gate_delay, false};
   }
-  
+
+  Wire NOT(const Wire &x) const {
+    return settle(~x.v, gd.NOT, x, x);
+  }
+
+  Wire AND(const Wire &x, const Wire &y) const {
+    if (all_zero(x) || all_zero(y)) {
+      return {0, 0.0, true}; // 制御値 0 で出力が確定
+    }
+    return settle(x.v & y.v, gd.AND, x, y);
+  }
+
+  Wire OR(const Wire &x, const Wire &y) const {
+    if (all_one(x) || all_one(y)) {
+      return {~0ULL, 0.0, true}; // 制御値 1 で出力が確定
+    }
+    return settle(x.v | y.v, gd.OR, x, y);
+  }
+
+  Wire NOR(const Wire &x, const Wire &y) const {
+    if (all_one(x) || all_one(y)) {
+      return {0, 0.0, true};
+    }
+    return settle(~(x.v | y.v), gd.NOR, x, y);
+  }
+
+  Wire XOR(const Wire &x, const Wire &y) const {
+    return settle(x.v ^ y.v, gd.XOR, x, y);
+  }
+
+  // sel=0 で in0, sel=1 で in1 を選択。選択が全レーンで一定なら選ばれた経路だけが遅延に効く
+  Wire MUX(const Wire &sel, const Wire &in0, const Wire &in1) const {
+    uint64_t v = (in0.v & ~sel.v) | (in1.v & sel.v);
+    if (all_zero(sel) || all_one(sel)) {
+      const Wire &chosen = all_zero(sel) ? in0 : in1;
+      if (chosen.fixed) {
+        return {v, 0.0, true};
+      }
+      return {v, chosen.t + gd.MUX, false};
+    }
+    Wire data = settle(v, 0.0, in0, in1);
+    return {v, std::max(data.t, sel.t) + gd.MUX, false};
+  }
+};
+
+// ALUクラス
+template <typename Config>
+class ALU {
+private:
   void update_flags(bool carry_out) {
     flags |= carry_out ? Flags::C : Flags::NC;
     flags |= (result == 0) ? Flags::Z : Flags::NZ;
@@ -104,36 +562,44 @@ public:
   uint8_t result;
   uint8_t flags;
 
-  // ALUの処理遅延
-  double alu_delay;
-
-  ALU() : result(0), flags(0) {}
+  // オペコード別のALU処理遅延（ゲート遅延モデルから算出）
+  double op_delay[8] = {};
 
-  void alu_setup(double new_alu_delay) {
-    if (is_setup) {
-      std::cerr << "Error: alu_setup() already called. Terminate." << std::endl;
-      exit(1);
+  ALU() : result(0), flags(0) {
+    if constexpr (Config::UseDelay) {
+      GateALU gate_alu(Config::ALUGateDelay);
+      for (uint8_t op = 0; op < 8; ++op) {
+        op_delay[op] = gate_alu.op_delay(static_cast<Opcode>(op));
+      }
+    }
+    if constexpr (Config::Verbose) {
+      std::cout << "ALU set up: ALU Delay:";
+      for (uint8_t op = 0; op < 8; ++op) {
+        std::cout << " " << OpcodeNames[op] << "=" << op_delay[op] << "s";
+      }
+      std::cout << std::endl;
     }
-    this->alu_delay = new_alu_delay;
-    is_setup = true;
-    std::cout << "ALU set up: "
-              << "ALU Delay: " << this->alu_delay << "s" << std::endl;
   }
 
   void execute(uint8_t A, uint8_t B, Opcode opcode) {
-    ensure_setup();
-  
+    PROFILE_SCOPE(ALU);
+    if constexpr (Config::UseDelay) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(op_delay[static_cast<uint8_t>(opcode)]));
+    }
+    compute(A, B, opcode);
+  }
+
+  // 遅延なしで演算のみを行う（ゲートレベルモデルとの照合にも使用）
+  void compute(uint8_t A, uint8_t B, Opcode opcode) {
     flags = 0;
     result = 0;
 
-    std::this_thread::sleep_for(std::chrono::duration<double>(alu_delay));
-
     bool is_arith = (static_cast<uint8_t>(opcode) & 0b100) == 0;
 
     if (is_arith) {
       bool B_invert = (static_cast<uint8_t>(opcode) & 0b010) != 0;
       uint8_t carry_in = 0;
-  　  if (opcode == Opcode::ADC || opcode == Opcode::SUB) {
+      if (opcode == Opcode::ADC || opcode == Opcode::SUB) {
         carry_in = 1;
       }
       // 加減算器の動作を再現
@@ -170,7 +636,6 @@ public:
   }
 
   void print_flags() const {
-    ensure_setup();
     std::cout << "C: " << ((flags & Flags::C) != 0)
               << ", NC: " << ((flags & Flags::NC) != 0)
               << ", Z: " << ((flags & Flags::Z) != 0)
@@ -181,256 +646,4596 @@ public:
 };
 
 // Registerクラス
+template <typename Config, uint8_t Count = Config::RegCount, bool ZeroReg = Config::UseZeroReg>
 class Register {
 private:
-  std::vector<uint8_t> regs;
-  bool has_zero_reg = false;
-  bool is_created = false;
+  std::array<uint8_t, Count> regs{};
 
   // アドレス範囲チェック
   void check_address(uint8_t addr) const {
-    if (addr >= regs.size()) {
+    if (addr >= Count) {
       std::cerr << "Error: Invalid address r" << +addr << ". Terminate."  << std::endl;
       exit(1);
     }
   }
 
-  // 初期化済みチェック
-  void ensure_created() const {
-    if (!is_created) {
-      std::cerr << "Error: Registers not created. Call reg_create(). Terminate."  << std::endl;
-      exit(1);
+  void delay(double seconds) const {
+    if constexpr (Config::UseDelay) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
     }
   }
 
 public:
-  double read_delay;  // 読み出し遅延
-  double write_delay; // 書き込み遅延
+  static constexpr double read_delay = Config::RegReadDelay;   // 読み出し遅延
+  static constexpr double write_delay = Config::RegWriteDelay; // 書き込み遅延
 
-  Register() = default;
-
-  // レジスタ生成（一度のみ呼び出せる）
-  void reg_create(uint8_t count, bool use_zero_register, double new_read_delay,    double new_write_delay) {
-    if (is_created) {
-      std::cerr << "Error: reg_setup() already called. Terminate." << std::endl;
-      exit(1);
+  // レジスタ生成（構成はコンフィグ型で固定）
+  Register() {
+    if constexpr (Config::Verbose) {
+      std::cout << "Registers created: " << +Count
+                << ", ZeroReg: " << (ZeroReg ? "Yes" : "No")
+                << std::endl
+                << "ReadDelay: " << read_delay << "s"
+                << ", Write delay: " << write_delay << "s" << std::endl;
     }
-    regs.assign(count, 0);
-    has_zero_reg = use_zero_register;
-    this->read_delay = new_read_delay;
-    this->write_delay = new_write_delay;
-    is_created = true;
-    std::cout << "Registers created: " << +count
-              << ", ZeroReg: " << (use_zero_register ? "Yes" : "No")
-              << std::endl
-              << "ReadDelay: " << this->read_delay << "s"
-              << ", Write delay: " << this->write_delay << "s" << std::endl;
   }
 
   // 全レジスタをクリア
   void reg_clear() {
-    ensure_created();
-    for (size_t i = 0; i < regs.size(); ++i) {
-      if (!(has_zero_reg && i == 0)) {
-        regs[i] = 0;
-      }
+    for (size_t i = (ZeroReg ? 1 : 0); i < Count; ++i) {
+      regs[i] = 0;
+    }
+    if constexpr (Config::Verbose) {
+      std::cout << "Registers cleared." << std::endl;
     }
-    std::cout << "Registers cleared." << std::endl;
   }
 
   // 書き込み
   void reg_write(uint8_t addr, uint8_t data) {
-    ensure_created();
+    PROFILE_SCOPE(RegWrite);
     check_address(addr);
-    if (has_zero_reg && addr == 0) {
-      std::cout << "Write ignored: Zero Register (r0)" << std::endl;
+    if (ZeroReg && addr == 0) {
+      if constexpr (Config::Verbose) {
+        std::cout << "Write ignored: Zero Register (r0)" << std::endl;
+      }
     } else {
       regs[addr] = data;
     }
-    std::this_thread::sleep_for(std::chrono::duration<double>(write_delay));
+    delay(write_delay);
   }
 
   // 読み出し（2つ同時）
   std::tuple<uint8_t, uint8_t> reg_read(uint8_t addr_a, uint8_t addr_b) {
-    ensure_created();
+    PROFILE_SCOPE(RegRead);
     check_address(addr_a);
     check_address(addr_b);
-    std::this_thread::sleep_for(std::chrono::duration<double>(read_delay));
+    delay(read_delay);
     return {regs[addr_a], regs[addr_b]};
   }
 
   // 読み出し（単一）
   uint8_t reg_read(uint8_t addr) {
-    ensure_created();
+    PROFILE_SCOPE(RegRead);
     check_address(addr);
-    std::this_thread::sleep_for(std::chrono::duration<double>(read_delay));
+    delay(read_delay);
     return regs[addr];
   }
 
+  // スナップショット用の一括読み書き（遅延なし）
+  const std::array<uint8_t, Count> &dump() const { return regs; }
+
+  void load(const std::array<uint8_t, Count> &values) {
+    regs = values;
+    if (ZeroReg) {
+      regs[0] = 0;
+    }
+  }
+
   // レジスタ一覧を表示
-  void print_all_regs() const {
+  void print_all_regs(const char* prefix = "r") const {
     std::cout << "--- Register Dump ---" << std::endl;
-    for (size_t i = 0; i < regs.size(); ++i) {
-      std::cout << "r" << i << ": " << std::setw(3) << std::setfill(' ')  << +regs[i] << " (0x" << std::hex << std::setw(2)  << std::setfill('0') << +regs[i] << std::dec  << std::setfill(' ') << ")" << std::endl;
+    for (size_t i = 0; i < Count; ++i) {
+      std::cout << prefix << i << ": " << std::setw(3) << std::setfill(' ')  << +regs[i] << " (0x" << std::hex << std::setw(2)  << std::setfill('0') << +regs[i] << std::dec  << std::setfill(' ') << ")" << std::endl;
     }
     std::cout << "---------------------" << std::endl;
   }
 };
 
-class Helper {
+// GateALU を ALU<Config> と同じインターフェースで使うアダプタ（1レーンのみ使用）
+template <typename Config>
+class GateALUEngine {
+private:
+  GateALU gate{Config::ALUGateDelay};
+
 public:
-  void alu_test(ALU &alu, uint8_t A, uint8_t B, Opcode opcode, const std::string &operation_name) {
-    std::cout << "Executing " << operation_name << "..." << std::flush;
-    alu.execute(A, B, opcode);
-    std::cout << " Done.\n";
-    std::cout << "  -> result: " << +alu.result << " (0x" << std::hex
-              << std::setw(2) << std::setfill('0') << +alu.result << std::dec
-              << ")\n";
-    std::cout << "  -> flags: ";
-    alu.print_flags();
-    std::cout << "\n";
-  }
+  uint8_t result = 0;
+  uint8_t flags = 0;
 
-  void reg_write_test(Register &reg, uint8_t addr, uint8_t data, const std::string &operation_name) {
-    std::cout << "Executing " << operation_name << "..." << std::flush;
-    reg.reg_write(addr, data);
-    std::cout << " Done.\n";
+  void execute(uint8_t A, uint8_t B, Opcode opcode) {
+    PROFILE_SCOPE(ALU);
+    compute(A, B, opcode);
+    if constexpr (Config::UseDelay) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(gate.delay));
+    }
   }
 
-  void reg_read_test(Register &reg, uint8_t addr_a, uint8_t addr_b, const std::string &operation_name) {
-    std::cout << "Executing " << operation_name << "..." << std::flush;
-    auto [value_a, value_b] = reg.reg_read(addr_a, addr_b);
-    std::cout << " Done.\n";
-    std::cout << "  -> read: r" << +addr_a << " = " << +value_a << ", "
-              << "r" << +addr_b << " = " << +value_b << "\n";
+  void compute(uint8_t A, uint8_t B, Opcode opcode) {
+    gate.evaluate(&A, &B, &opcode, 1);
+    result = gate.result[0];
+    flags = gate.flags[0];
   }
+};
 
-  void combined_test(ALU &alu, Register &reg, uint8_t addr_a, uint8_t addr_b, uint8_t result_addr, Opcode opcode, const std::string &operation_name) {
-    std::cout << "Executing " << operation_name << "..." << std::flush;
+// ハードウェアスタック（CALstack / GPRstack）
+// あふれ・空読みはプログラム側の誤りなので終了せず false を返す
+template <typename T, size_t Depth>
+class HardwareStack {
+private:
+  std::array<T, Depth> data{};
+  size_t sp = 0;
 
-    // レジスタから値を読み出し
-    auto [val_a, val_b] = reg.reg_read(addr_a, addr_b);
-    // ALU演算を実行
-    alu.execute(val_a, val_b, opcode);
-    // 結果をレジスタに書き込み
-    reg.reg_write(result_addr, alu.result);
-    
-    std::cout << " Done.\n";
-    std::cout << "  -> operands: r" << +addr_a << "=" << +val_a << ", r" << +addr_b << "=" << +val_b << "\n";
-    std::cout << "  -> result: " << +alu.result << " (0x" << std::hex << std::setw(2)
-              << std::setfill('0') << +alu.result << std::dec << ") -> r" << +result_addr << "\n";
-    std::cout << "  -> flags: ";
-    alu.print_flags();
-    std::cout << "\n";
+public:
+  bool push(T value) {
+    if (sp >= Depth) {
+      return false;
+    }
+    data[sp++] = value;
+    return true;
   }
-  
-  void halt(double Time_sec) {
-    std::this_thread::sleep_for(std::chrono::duration<double>(Time_sec));
+
+  bool pop(T &value) {
+    if (sp == 0) {
+      return false;
+    }
+    value = data[--sp];
+    return true;
   }
-};
 
-void ALU_TESTS(Helper &run) {
-  std::cout << Colors::CYAN << Colors::BOLD << "\n==== ALU TESTS ====" << Colors::RESET << std::endl;
-  ALU alu;
-  alu.alu_setup(CPUConfig::ALUDelay);
-  std::cout << std::endl;
+  size_t size() const { return sp; }
+  void clear() { sp = 0; }
 
-  std::cout << Colors::YELLOW << "--- Arithmetic Operations ---" << Colors::RESET << std::endl;
-  run.alu_test(alu, 100, 200, Opcode::ADD, "ADD (100 + 200)");
-  run.alu_test(alu, 100, 200, Opcode::ADC, "ADC (100 + 200 + 1)");
-  run.alu_test(alu, 1, 200, Opcode::SUB, "SUB (1 - 200)");
-  run.alu_test(alu, 1, 200, Opcode::SBC, "SBC (1 - 200 - 1)");
+  bool operator==(const HardwareStack &other) const {
+    return sp == other.sp && std::equal(data.begin(), data.begin() + sp, other.data.begin());
+  }
+};
 
-  std::cout << std::endl << Colors::YELLOW << "--- Logic Operations ---" << Colors::RESET << std::endl;
-  run.alu_test(alu, 0b01110111, 0b00001111, Opcode::NOR, "NOR (~(0b01110111 | 0b00001111))");
-  run.alu_test(alu, 0b10010010, 0b01111011, Opcode::AND, "AND (0b10010010 & 0b01111011)");
-  run.alu_test(alu, 0b01100111, 0b00110011, Opcode::XOR, "XOR (0b01100111 ^ 0b00110011)");
-  run.alu_test(alu, 0b10101010, 0b01010101, Opcode::RSH, "RSH ((0b10101010 | 0b01010101) >> 1)");
+// 命令の種類（CPUSPECS.md 第3部のうち、8演算ALUで実行できるもの）
+enum class InstKind : uint8_t {
+  NOP, ALU, CMP, ADI, SBI, ANI, CMI, LDI, MOV, API, APD,
+  MLD, MST, PLD, PST, JMP, BRH, CAL, RET, PSH, POP, HLT,
+  TRAP // 予約: デバッガがブレークポイントの位置に書き込む
+};
 
-  std::cout << std::endl << Colors::GREEN << Colors::BOLD << "✓ ALU tests completed." << Colors::RESET << std::endl;
-}
+constexpr const char* InstKindNames[] = {
+  "NOP", "ALU", "CMP", "ADI", "SBI", "ANI", "CMI", "LDI", "MOV", "API", "APD",
+  "MLD", "MST", "PLD", "PST", "JMP", "BRH", "CAL", "RET", "PSH", "POP", "HLT",
+  "TRAP"
+};
 
-void REG_TESTS(Helper &run){
-  std::cout << Colors::CYAN << Colors::BOLD << "\n==== REGISTER TESTS ====" << Colors::RESET << std::endl;
-  Register reg;
-  reg.reg_create(CPUConfig::RegCount, CPUConfig::UseZeroReg, CPUConfig::RegReadDelay, CPUConfig::RegWriteDelay);
-  std::cout << std::endl;
+// BRH の条件コード
+enum class Cond : uint8_t { Z, NZ, C, NC };
 
-  std::cout << Colors::YELLOW << "--- Write Operations ---" << Colors::RESET << std::endl;
-  run.reg_write_test(reg, 1, 100, "Write 100 to r1");
-  run.reg_write_test(reg, 2, 200, "Write 200 to r2");
-  run.reg_write_test(reg, 0, 255, "Attempt write 255 to r0 (should be ignored)");
-  std::cout << std::endl;
-  reg.print_all_regs();
+constexpr const char* CondNames[] = {"Z", "NZ", "C", "NC"};
 
-  std::cout << std::endl << Colors::YELLOW << "--- Read Operations ---" << Colors::RESET << std::endl;
-  run.reg_read_test(reg, 1, 2, "Read from r1 and r2");
-  run.reg_read_test(reg, 0, 0, "Read from r0 twice");
-  run.reg_read_test(reg, 0, 1, "Read from r0 and r1");
+// プリデコード済み命令（ROM 1ワードを解釈した結果）
+struct Instruction {
+  InstKind kind = InstKind::NOP;
+  Opcode alu_op = Opcode::ADD; // ALU 命令の演算
+  uint8_t a = 0;               // rA / apA / 条件コード
+  uint8_t b = 0;               // rB / apB / 即値
+  uint8_t c = 0;               // rC / apC / オフセット
+  uint16_t addr = 0;           // JMP / BRH / CAL の飛び先（10bit）
+};
 
-  std::cout << std::endl << Colors::YELLOW << "--- Clear Operation ---" << Colors::RESET << std::endl;
-  reg.reg_clear();
-  reg.print_all_regs();
+using Program = std::vector<Instruction>;
 
-  std::cout << std::endl << Colors::GREEN << Colors::BOLD << "✓ Register tests completed." << Colors::RESET << std::endl;
+// 命令をアセンブリ表記に戻す
+std::string disassemble(const Instruction &inst) {
+  std::ostringstream out;
+  auto r = [](uint8_t n) { return "r" + std::to_string(n); };
+  auto ap = [](uint8_t n) { return "ap" + std::to_string(n); };
+  switch (inst.kind) {
+    case InstKind::ALU: out << OpcodeNames[static_cast<uint8_t>(inst.alu_op)] << " " << r(inst.a) << ", " << r(inst.b) << ", " << r(inst.c); break;
+    case InstKind::CMP: out << "CMP " << r(inst.a) << ", " << r(inst.b); break;
+    case InstKind::ADI:
+    case InstKind::SBI:
+    case InstKind::ANI:
+    case InstKind::CMI:
+    case InstKind::LDI: out << InstKindNames[static_cast<uint8_t>(inst.kind)] << " " << r(inst.a) << ", " << +inst.b; break;
+    case InstKind::MOV: out << "MOV " << r(inst.a) << ", " << r(inst.b); break;
+    case InstKind::API: out << "API " << ap(inst.a) << ", " << +inst.b; break;
+    case InstKind::APD: out << "APD " << r(inst.a) << ", " << r(inst.b) << ", " << ap(inst.c); break;
+    case InstKind::MLD:
+    case InstKind::MST:
+    case InstKind::PLD:
+    case InstKind::PST: out << InstKindNames[static_cast<uint8_t>(inst.kind)] << " " << r(inst.a) << ", " << ap(inst.b) << ", " << +inst.c; break;
+    case InstKind::JMP:
+    case InstKind::CAL: out << InstKindNames[static_cast<uint8_t>(inst.kind)] << " " << inst.addr; break;
+    case InstKind::BRH: out << "BRH " << CondNames[inst.a & 0b11] << ", " << inst.addr; break;
+    case InstKind::PSH:
+    case InstKind::POP: out << InstKindNames[static_cast<uint8_t>(inst.kind)] << " " << r(inst.a); break;
+    default: out << InstKindNames[static_cast<uint8_t>(inst.kind)]; break;
+  }
+  return out.str();
 }
 
-void COMBINED_TESTS(Helper &run) {
-  std::cout << Colors::CYAN << Colors::BOLD << "\n==== COMBINED ALU + REGISTER TESTS ====" << Colors::RESET << std::endl;
-  ALU alu;
-  Register reg;
-  alu.alu_setup(CPUConfig::ALUDelay);
-  reg.reg_create(CPUConfig::RegCount, CPUConfig::UseZeroReg, CPUConfig::RegReadDelay, CPUConfig::RegWriteDelay);
-  std::cout << std::endl;
+// ROM ファイルを読む（disassemble の逆: 1行1命令、行の順に 0 番地から配置、';' 以降はコメント）
+// 例: "ADD r1, r2, r3" / "LDI r5, 0" / "PLD r1, ap0, 1" / "BRH NZ, 2" / "HLT"
+// path はエラー表示にだけ使う
+Program read_rom(std::istream &in, const std::string &path) {
+  Program rom;
+  std::string line;
+  size_t number = 0;
+  auto fail = [&](const std::string &reason) {
+    std::cerr << "Error: " << path << ":" << number << ": " << reason << ". Terminate." << std::endl;
+    exit(1);
+  };
+  // 10進数か 0x で始まる16進数で、max 以下のもの
+  auto value = [&](const std::string &text, unsigned max) {
+    size_t used = 0;
+    unsigned long n = 0;
+    bool digits = !text.empty() && std::isdigit(static_cast<unsigned char>(text[0]));
+    try {
+      n = digits ? std::stoul(text, &used, text.compare(0, 2, "0x") == 0 ? 16 : 10) : 0;
+    } catch (const std::exception &) {
+      digits = false;
+    }
+    if (!digits || used != text.size()) {
+      fail("'" + text + "' is not a number");
+    }
+    if (n > max) {
+      fail("'" + text + "' is out of range (0-" + std::to_string(max) + ")");
+    }
+    return static_cast<uint16_t>(n);
+  };
+  // 接頭辞 (r / ap) つきの番号
+  auto numbered = [&](const std::string &text, const std::string &prefix) {
+    if (text.compare(0, prefix.size(), prefix) != 0 || text.size() == prefix.size()) {
+      fail("expected " + prefix + "N, got '" + text + "'");
+    }
+    return static_cast<uint8_t>(value(text.substr(prefix.size()), 15));
+  };
+  while (std::getline(in, line)) {
+    ++number;
+    line = line.substr(0, line.find(';'));
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream fields(line);
+    std::string mnemonic;
+    if (!(fields >> mnemonic)) {
+      continue;
+    }
+    std::transform(mnemonic.begin(), mnemonic.end(), mnemonic.begin(), [](unsigned char c) { return std::toupper(c); });
+    std::vector<std::string> ops;
+    for (std::string op; fields >> op;) {
+      std::transform(op.begin(), op.end(), op.begin(), [](unsigned char c) { return std::tolower(c); });
+      ops.push_back(op);
+    }
+    auto operands = [&](size_t count) {
+      if (ops.size() != count) {
+        fail(mnemonic + " takes " + std::to_string(count) + " operands, got " + std::to_string(ops.size()));
+      }
+    };
+    Instruction inst;
+    auto alu = std::find_if(std::begin(OpcodeNames), std::end(OpcodeNames), [&](const char *name) { return mnemonic == name; });
+    auto kind = std::find_if(std::begin(InstKindNames), std::end(InstKindNames), [&](const char *name) { return mnemonic == name; });
+    if (alu != std::end(OpcodeNames)) {
+      operands(3);
+      inst = {InstKind::ALU, static_cast<Opcode>(alu - std::begin(OpcodeNames)), numbered(ops[0], "r"), numbered(ops[1], "r"), numbered(ops[2], "r")};
+    } else if (kind == std::end(InstKindNames) || *kind == std::string("ALU") || *kind == std::string("TRAP")) {
+      fail("unknown instruction '" + mnemonic + "'");
+    } else {
+      inst.kind = static_cast<InstKind>(kind - std::begin(InstKindNames));
+      switch (inst.kind) {
+        case InstKind::CMP:
+        case InstKind::MOV: operands(2); inst.a = numbered(ops[0], "r"); inst.b = numbered(ops[1], "r"); break;
+        case InstKind::ADI:
+        case InstKind::SBI:
+        case InstKind::ANI:
+        case InstKind::CMI:
+        case InstKind::LDI: operands(2); inst.a = numbered(ops[0], "r"); inst.b = static_cast<uint8_t>(value(ops[1], 255)); break;
+        case InstKind::API: operands(2); inst.a = numbered(ops[0], "ap"); inst.b = static_cast<uint8_t>(value(ops[1], 255)); break;
+        case InstKind::APD: operands(3); inst.a = numbered(ops[0], "r"); inst.b = numbered(ops[1], "r"); inst.c = numbered(ops[2], "ap"); break;
+        case InstKind::MLD:
+        case InstKind::MST:
+        case InstKind::PLD:
+        case InstKind::PST: operands(3); inst.a = numbered(ops[0], "r"); inst.b = numbered(ops[1], "ap"); inst.c = static_cast<uint8_t>(value(ops[2], 15)); break; // オフセットは 0〜15
+        case InstKind::JMP:
+        case InstKind::CAL: operands(1); inst.addr = value(ops[0], 1023); break;
+        case InstKind::BRH: {
+          operands(2);
+          std::string cond = ops[0];
+          std::transform(cond.begin(), cond.end(), cond.begin(), [](unsigned char c) { return std::toupper(c); });
+          auto it = std::find_if(std::begin(CondNames), std::end(CondNames), [&](const char *name) { return cond == name; });
+          if (it == std::end(CondNames)) {
+            fail("unknown condition '" + ops[0] + "' (Z, NZ, C or NC)");
+          }
+          inst.a = static_cast<uint8_t>(it - std::begin(CondNames));
+          inst.addr = value(ops[1], 1023);
+          break;
+        }
+        case InstKind::PSH:
+        case InstKind::POP: operands(1); inst.a = numbered(ops[0], "r"); break;
+        default: operands(0); break;
+      }
+    }
+    if (rom.size() >= 1024) {
+      fail("program does not fit in ROM (1024 words)");
+    }
+    rom.push_back(inst);
+  }
+  if (rom.empty()) {
+    std::cerr << "Error: " << path << " contains no instructions. Terminate." << std::endl;
+    exit(1);
+  }
+  return rom;
+}
 
-  std::cout << Colors::YELLOW << "--- Setup: Initialize registers ---" << Colors::RESET << std::endl;
-  // テスト用の初期値をレジスタに設定
-  std::cout << Colors::DIM << "Setting up test values..." << Colors::RESET << std::endl;
-  reg.reg_write(1, 150);  // r1 = 150
-  reg.reg_write(2, 100);  // r2 = 100
-  reg.reg_write(3, 50);   // r3 = 50
-  reg.reg_write(4, 255);  // r4 = 255
+Program read_rom(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "Error: Cannot read " << path << ". Terminate." << std::endl;
+    exit(1);
+  }
+  return read_rom(in, path);
+}
 
-  std::cout << std::endl << Colors::BOLD << "Initial register state:" << Colors::RESET << std::endl;
-  reg.print_all_regs();
+// 基本ブロックの終端になる命令（制御フローの切り替え・停止）
+bool is_block_end(const Instruction &inst) {
+  switch (inst.kind) {
+    case InstKind::JMP:
+    case InstKind::BRH:
+    case InstKind::CAL:
+    case InstKind::RET:
+    case InstKind::HLT:
+      return true;
+    default:
+      return false;
+  }
+}
 
-  std::cout << std::endl << Colors::YELLOW << "--- ALU + Register Operations ---" << Colors::RESET << std::endl;
-  // 組み合わせテストの実行
-  run.combined_test(alu, reg, 1, 2, 5, Opcode::ADD, "ADD r1+r2 -> r5 (150+100)");
-  std::cout << std::endl;
-  run.combined_test(alu, reg, 1, 3, 6, Opcode::SUB, "SUB r1-r3 -> r6 (150-50)");
-  std::cout << std::endl;
-  run.combined_test(alu, reg, 2, 4, 7, Opcode::AND, "AND r2&r4 -> r7 (100&255)");
-  std::cout << std::endl;
-  run.combined_test(alu, reg, 5, 6, 1, Opcode::XOR, "XOR r5^r6 -> r1 (result^result)");
+// アーキテクチャ状態（スナップショットとエンジン間の比較に使用）
+template <typename Config>
+struct CPUState {
+  std::array<uint8_t, Config::RegCount> regs{};
+  std::array<uint8_t, Config::ApCount> aps{};
+  std::array<uint8_t, Config::RAMSize> ram{};
+  std::array<uint8_t, Config::PortCount> in_ports{};
+  std::array<uint8_t, Config::PortCount> out_ports{};
+  HardwareStack<uint16_t, Config::CallStackDepth> call_stack;
+  HardwareStack<uint8_t, Config::GPRStackDepth> gpr_stack;
+  uint8_t flags = 0;
+  uint16_t pc = 0;
+  bool halted = false;
 
-  std::cout << std::endl << Colors::BOLD << "Final register state:" << Colors::RESET << std::endl;
-  reg.print_all_regs();
+  bool operator==(const CPUState &other) const {
+    return regs == other.regs && aps == other.aps && ram == other.ram && in_ports == other.in_ports &&
+           out_ports == other.out_ports && call_stack == other.call_stack && gpr_stack == other.gpr_stack &&
+           flags == other.flags && pc == other.pc && halted == other.halted;
+  }
+  bool operator!=(const CPUState &other) const { return !(*this == other); }
+};
 
-  std::cout << std::endl << Colors::GREEN << Colors::BOLD << "✓ Combined ALU+Register tests completed." << Colors::RESET << std::endl;
-}
+// シーケンスロック（書き込み側は待たない。読み出し側は書き込み中・途中で書き換わった値を検出して読み直す）
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires a trivially copyable type");
+  static constexpr size_t Words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
 
-// テスト
-int main() {
-  Helper run;
+  std::atomic<uint64_t> sequence{0};
+  std::array<std::atomic<uint64_t>, Words> words{};
+
+public:
+  // 書き込みは1スレッドからのみ
+  void store(const T &value) {
+    PROFILE_SCOPE(Trace);
+    uint64_t buffer[Words] = {};
+    std::memcpy(buffer, &value, sizeof(T));
+    uint64_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed); // 奇数: 書き込み中
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < Words; ++i) {
+      words[i].store(buffer[i], std::memory_order_relaxed);
+    }
+    sequence.store(seq + 2, std::memory_order_release);
+  }
+
+  // 一貫した値が読めるまで読み直し、そのときの版数を返す
+  uint64_t load(T &value) const {
+    uint64_t buffer[Words];
+    while (true) {
+      uint64_t before = sequence.load(std::memory_order_acquire);
+      if (before & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      for (size_t i = 0; i < Words; ++i) {
+        buffer[i] = words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == before) {
+        std::memcpy(&value, buffer, sizeof(T));
+        return before;
+      }
+    }
+  }
+};
+
+// ウォッチポイント
+enum class WatchSpace : uint8_t { RAM, Port };
+
+namespace WatchKind {
+  constexpr uint8_t Read = 1 << 0;
+  constexpr uint8_t Write = 1 << 1;
+  constexpr uint8_t Change = 1 << 2; // 書き込みで値が変わったときだけ
+}
+
+struct WatchHit {
+  WatchSpace space;
+  uint8_t kind;    // WatchKind のどれか1つ
+  uint8_t addr;
+  uint8_t old_value;
+  uint8_t new_value;
+  uint16_t pc;
+};
+
+// 監視するアドレスの 256bit マスクと、アドレスごとの監視の種類
+struct WatchTable {
+  std::array<uint64_t, 4> mask{};
+  std::array<uint8_t, 256> kinds{};
+
+  bool watched(uint8_t addr) const { return (mask[addr >> 6] >> (addr & 63)) & 1; }
+
+  void set(uint8_t addr, uint8_t kind) {
+    kinds[addr] |= kind;
+    mask[addr >> 6] |= uint64_t{1} << (addr & 63);
+  }
+
+  void clear(uint8_t addr) {
+    kinds[addr] = 0;
+    mask[addr >> 6] &= ~(uint64_t{1} << (addr & 63));
+  }
+};
+
+// BRH ごとの成立・不成立回数（CPU::branches に設定すると BRH で数える）
+// パイプラインは常に不成立と予測するので、成立した回数がそのままフラッシュの回数になる
+struct BranchProfile {
+  struct Counts {
+    uint64_t taken = 0;
+    uint64_t not_taken = 0;
+  };
+  std::array<Counts, 1024> counts{}; // pc（10bit）で引く
+
+  void record(uint16_t pc, bool taken) {
+    Counts &c = counts[pc & 0x3FF];
+    ++(taken ? c.taken : c.not_taken);
+  }
+
+  void merge(const BranchProfile &other) {
+    for (size_t pc = 0; pc < counts.size(); ++pc) {
+      counts[pc].taken += other.counts[pc].taken;
+      counts[pc].not_taken += other.counts[pc].not_taken;
+    }
+  }
+
+  uint64_t flushes() const {
+    uint64_t total = 0;
+    for (const Counts &c : counts) {
+      total += c.taken;
+    }
+    return total;
+  }
+
+  // コード生成器の位置表（1行に "pc 位置"。例: "13 main.zpp:12:5#0/T"）を pc ごとの位置に展開する
+  static std::vector<std::string> read_locations(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+      std::cerr << "Error: Cannot read " << path << ". Terminate." << std::endl;
+      exit(1);
+    }
+    std::vector<std::string> locations;
+    size_t pc = 0;
+    std::string location;
+    while (in >> pc >> location) {
+      if (pc >= 1024) {
+        continue;
+      }
+      if (locations.size() <= pc) {
+        locations.resize(pc + 1);
+      }
+      locations[pc] = location;
+    }
+    return locations;
+  }
+
+  // 位置 -> 回数（位置表にない pc は "pc:13" とする。同じ位置の BRH は合算する）
+  std::map<std::string, Counts> by_location(const Program &rom, const std::vector<std::string> &locations) const {
+    std::map<std::string, Counts> result;
+    for (size_t pc = 0; pc < std::min(rom.size(), counts.size()); ++pc) {
+      const Counts &c = counts[pc];
+      if (rom[pc].kind != InstKind::BRH || c.taken + c.not_taken == 0) {
+        continue;
+      }
+      std::string key = pc < locations.size() && !locations[pc].empty() ? locations[pc] : "pc:" + std::to_string(pc);
+      result[key].taken += c.taken;
+      result[key].not_taken += c.not_taken;
+    }
+    return result;
+  }
+
+  // 例: "  13: BRH NC, 15  sweep.zpp:5:5#0/F  taken 32640 / not taken 32896 (49.8%)"
+  // 成立の方が多い BRH は、条件を反転して成立側を fall-through にすべき候補として印を付ける
+  void print(const Program &rom, const std::vector<std::string> &locations) const {
+    for (size_t pc = 0; pc < std::min(rom.size(), counts.size()); ++pc) {
+      const Counts &c = counts[pc];
+      if (rom[pc].kind != InstKind::BRH || c.taken + c.not_taken == 0) {
+        continue;
+      }
+      double ratio = 100.0 * static_cast<double>(c.taken) / static_cast<double>(c.taken + c.not_taken);
+      std::cout << "  " << std::setw(4) << pc << ": " << std::left << std::setw(12) << disassemble(rom[pc]) << std::right;
+      if (pc < locations.size() && !locations[pc].empty()) {
+        std::cout << "  " << locations[pc];
+      }
+      std::cout << "  taken " << c.taken << " / not taken " << c.not_taken
+                << " (" << std::fixed << std::setprecision(1) << ratio << "%)" << std::defaultfloat;
+      if (c.taken > c.not_taken) {
+        // 後ろ向きの分岐はループの back-edge（反転ではなく回転・展開の対象）
+        std::cout << Colors::YELLOW << (rom[pc].addr <= pc ? "  <- hot back-edge" : "  <- invert") << Colors::RESET;
+      }
+      std::cout << "\n";
+    }
+  }
+
+  // profile.json の "branches" 項目（COMPILER.md §6.10）
+  // existing に既存の profile.json を渡すと、"branches" だけを置き換え（なければ追加し）、"calls" などはそのまま残す
+  // existing が JSON オブジェクトとして読めなければ nullopt
+  std::optional<std::string> to_json(const Program &rom, const std::vector<std::string> &locations, const std::string &existing = "") const {
+    std::ostringstream value;
+    value << "{";
+    const char *separator = "\n";
+    for (const auto &[key, c] : by_location(rom, locations)) {
+      value << separator << "    \"" << key << "\": { \"taken\": " << c.taken << ", \"not_taken\": " << c.not_taken << " }";
+      separator = ",\n";
+    }
+    value << "\n  }";
+    if (existing.find_first_not_of(" \t\r\n") == std::string::npos) {
+      return "{\n  \"branches\": " + value.str() + "\n}\n";
+    }
+    return replace_member(existing, "branches", value.str());
+  }
+
+private:
+  // トップレベルのオブジェクトのメンバー key の値を value に置き換える（なければ末尾に追加する）
+  static std::optional<std::string> replace_member(const std::string &json, const std::string &key, const std::string &value) {
+    size_t i = 0;
+    auto skip_space = [&] {
+      while (i < json.size() && std::isspace(static_cast<unsigned char>(json[i]))) {
+        ++i;
+      }
+    };
+    // 文字列を読み飛ばし、中身（エスケープはそのまま）を返す
+    auto skip_string = [&](std::string *text) {
+      if (i >= json.size() || json[i] != '"') {
+        return false;
+      }
+      for (++i; i < json.size(); ++i) {
+        if (json[i] == '\\') {
+          if (text) {
+            text->push_back(json[i]);
+          }
+          ++i;
+        } else if (json[i] == '"') {
+          ++i;
+          return true;
+        }
+        if (text && i < json.size()) {
+          text->push_back(json[i]);
+        }
+      }
+      return false;
+    };
+    // 値を1つ読み飛ばす（括弧の対応と文字列だけを見る）
+    auto skip_value = [&] {
+      int depth = 0;
+      while (i < json.size()) {
+        char c = json[i];
+        if (c == '"') {
+          if (!skip_string(nullptr)) {
+            return false;
+          }
+          continue;
+        }
+        if (depth == 0 && (c == ',' || c == '}')) {
+          return true;
+        }
+        if (c == '{' || c == '[') {
+          ++depth;
+        } else if (c == '}' || c == ']') {
+          if (--depth < 0) {
+            return false;
+          }
+        }
+        ++i;
+      }
+      return false;
+    };
+    skip_space();
+    if (i >= json.size() || json[i] != '{') {
+      return std::nullopt;
+    }
+    ++i;
+    size_t value_begin = 0;
+    size_t value_end = 0;
+    size_t last_end = 0; // 最後のメンバーの値の終わり（追加する位置）
+    skip_space();
+    if (i < json.size() && json[i] == '}') {
+      ++i;
+    } else {
+      while (true) {
+        skip_space();
+        std::string name;
+        if (!skip_string(&name)) {
+          return std::nullopt;
+        }
+        skip_space();
+        if (i >= json.size() || json[i] != ':') {
+          return std::nullopt;
+        }
+        ++i;
+        skip_space();
+        size_t begin = i;
+        if (begin >= json.size() || json[begin] == ',' || json[begin] == '}' || !skip_value()) {
+          return std::nullopt;
+        }
+        size_t end = i;
+        while (end > begin && std::isspace(static_cast<unsigned char>(json[end - 1]))) {
+          --end;
+        }
+        if (name == key) {
+          value_begin = begin;
+          value_end = end;
+        }
+        last_end = end;
+        if (json[i++] == '}') {
+          break;
+        }
+      }
+    }
+    size_t close = i - 1;
+    skip_space();
+    if (i != json.size()) {
+      return std::nullopt;
+    }
+    if (value_end != 0) {
+      return json.substr(0, value_begin) + value + json.substr(value_end);
+    }
+    if (last_end == 0) {
+      return json.substr(0, close) + "\n  \"" + key + "\": " + value + "\n" + json.substr(close);
+    }
+    return json.substr(0, last_end) + ",\n  \"" + key + "\": " + value + json.substr(last_end);
+  }
+};
+
+// ダッシュボードへ公開する状態
+template <typename Config>
+struct MonitorSample {
+  CPUState<Config> state;
+  uint64_t steps = 0;
+};
+
+// 純粋なサブルーチンのメモ化（CPU::memo に設定すると CAL / RET / MLD / MST で使われる）
+// ROM を書き換えたら clear() で解析結果を捨てる。RAM を step の外で書き換えたら forget_ram() を呼ぶ
+template <typename Config>
+class Memoizer {
+public:
+  static constexpr size_t TableSize = 4096; // 直接マップ。衝突したら上書き
+
+  using Aps = std::array<uint8_t, Config::ApCount>;
+  using RamMask = std::array<uint64_t, 4>; // RAM のアドレスごとに1ビット（WatchTable::mask と同じ並び）
+
+  // 純粋な呼び出し先の解析結果
+  struct Summary {
+    uint8_t call_depth;  // 呼び出し先の中で使う CALstack の深さ
+    uint8_t stack_depth; // 呼び出し先の中で使う GPRstack の深さ
+    uint64_t writes;     // 書くレジスタ (bit n: rn)、フラグ (bit 16)、アドレスレジスタ (bit 32 + n: apn)。ヒット時はこれだけを書き戻す
+    uint16_t ap_reads;   // MLD が呼び出し元の値のまま使うアドレスレジスタ（その値もキーにする）
+    bool reads_ram;      // MLD を含む（呼び出し先の中も含めて）
+  };
+
+  struct Entry {
+    bool valid = false;
+    uint16_t target = 0;
+    uint32_t args = 0;
+    Aps ap_args{};                  // 呼び出したときのアドレスレジスタ（Summary::ap_reads のものだけ比べる）
+    std::array<uint8_t, 15> regs{}; // 戻ったときの r1〜r15
+    Aps aps{};                      // 戻ったときのアドレスレジスタ
+    uint8_t flags = 0;
+    uint64_t instructions = 0;      // CAL の次から RET まで
+    double seconds = 0.0;           // 遅延ありの構成で実行にかかった時間
+    RamMask reads{};                // MLD で読んだアドレス
+  };
+
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t impure_calls = 0;
+  uint64_t invalidated = 0; // MST や RAM の置き換えで捨てた結果の数
+
+  Memoizer() : table(TableSize) {}
+
+  void clear() {
+    summaries.clear();
+    std::fill(table.begin(), table.end(), Entry{});
+    pending.clear();
+    watched = {};
+  }
+
+  // 純粋でなければ nullptr
+  const Summary *summary(const Program &rom, uint16_t target) {
+    if (analyzed != &rom) {
+      summaries.clear();
+      analyzed = &rom;
+    }
+    auto it = summaries.find(target);
+    if (it == summaries.end()) {
+      summaries[target] = std::nullopt; // 解析中（再帰呼び出しは純粋としない）
+      it = summaries.find(target);
+      it->second = analyze(rom, target);
+    }
+    if (!it->second) {
+      ++impure_calls;
+      return nullptr;
+    }
+    return &*it->second;
+  }
+
+  const Entry *find(const Summary &summary, uint16_t target, uint32_t args, const Aps &aps) {
+    const Entry &e = table[slot(target, args)];
+    if (e.valid && e.target == target && e.args == args && same_aps(e.ap_args, aps, summary.ap_reads)) {
+      ++hits;
+      // 省略した呼び出しが読んだアドレスは、記録中の呼び出しも読んだことになる
+      for (Pending &p : pending) {
+        for (size_t k = 0; k < p.reads.size(); ++k) p.reads[k] |= e.reads[k];
+      }
+      return &e;
+    }
+    ++misses;
+    return nullptr;
+  }
+
+  // 記録の開始（CAL の実行時）と終了（対応する RET の実行時）
+  void begin(uint16_t target, uint32_t args, const Aps &aps, size_t call_depth, uint64_t retired) {
+    pending.push_back({target, args, aps, call_depth, retired, std::chrono::steady_clock::now(), {}});
+  }
+
+  bool recording(size_t call_depth) const { return !pending.empty() && pending.back().call_depth == call_depth; }
+
+  template <size_t Count>
+  void finish(const std::array<uint8_t, Count> &regs, const Aps &aps, uint8_t flags, uint64_t retired) {
+    const Pending &p = pending.back();
+    Entry &e = table[slot(p.target, p.args)];
+    e.valid = true;
+    e.target = p.target;
+    e.args = p.args;
+    e.ap_args = p.aps;
+    std::copy(regs.begin() + 1, regs.begin() + std::min<size_t>(Count, 16), e.regs.begin());
+    e.aps = aps;
+    e.flags = flags;
+    e.instructions = retired - p.retired;
+    e.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - p.start).count();
+    e.reads = p.reads;
+    for (size_t k = 0; k < watched.size(); ++k) watched[k] |= p.reads[k];
+    pending.pop_back();
+  }
+
+  // MLD で読んだアドレスを、記録中の呼び出しすべてに加える
+  void read(uint8_t addr) {
+    for (Pending &p : pending) {
+      p.reads[addr >> 6] |= uint64_t{1} << (addr & 63);
+    }
+  }
+
+  // MST で書いたアドレスを読んだ結果を捨てる
+  void write(uint8_t addr) {
+    if ((watched[addr >> 6] >> (addr & 63)) & 1) {
+      forget([addr](const RamMask &reads) { return (reads[addr >> 6] >> (addr & 63)) & 1; });
+    }
+  }
+
+  // RAM を読んだ結果をすべて捨てる（RAM を丸ごと置き換えたとき）
+  void forget_ram() {
+    if (std::any_of(watched.begin(), watched.end(), [](uint64_t w) { return w != 0; })) {
+      forget([](const RamMask &reads) { return std::any_of(reads.begin(), reads.end(), [](uint64_t w) { return w != 0; }); });
+    }
+  }
+
+  // 途中で止まった呼び出しの記録を捨てる（reset / restore）
+  void abandon() { pending.clear(); }
+
+private:
+  struct Pending {
+    uint16_t target;
+    uint32_t args;
+    Aps aps;
+    size_t call_depth; // CAL を積む前の CALstack の深さ
+    uint64_t retired;
+    std::chrono::steady_clock::time_point start;
+    RamMask reads;
+  };
+
+  std::vector<Entry> table;
+  std::map<uint16_t, std::optional<Summary>> summaries;
+  const Program *analyzed = nullptr;
+  std::vector<Pending> pending;
+  RamMask watched{}; // 表にある結果が読んだアドレスの和（MST ごとにこれだけを調べる）
+
+  static size_t slot(uint16_t target, uint32_t args) {
+    uint64_t h = (uint64_t{target} << 32 | args) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>(h >> 52) & (TableSize - 1);
+  }
+
+  static bool same_aps(const Aps &a, const Aps &b, uint16_t mask) {
+    for (size_t n = 1; n < a.size(); ++n) {
+      if (((mask >> n) & 1) && a[n] != b[n]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // stale(reads) が真の結果を捨て、残ったものから watched を作り直す
+  template <typename Pred>
+  void forget(Pred stale) {
+    watched = {};
+    for (Entry &e : table) {
+      if (!e.valid) {
+        continue;
+      }
+      if (stale(e.reads)) {
+        e.valid = false;
+        ++invalidated;
+      } else {
+        for (size_t k = 0; k < watched.size(); ++k) watched[k] |= e.reads[k];
+      }
+    }
+  }
+
+  // 到達可能な命令をたどり、書く前に読むレジスタ・フラグ・アドレスレジスタと GPRstack の深さを調べる
+  // PSH で退避した呼び出し元の値を同じレジスタへ POP で戻すもの（Callee-Saved の退避）は書き込みとみなさない
+  std::optional<Summary> analyze(const Program &rom, uint16_t target) {
+    if (Config::RegCount < 16) {
+      return std::nullopt; // 呼び出し規約 (r1〜r4 -> r15) が前提
+    }
+    constexpr uint64_t FlagsBit = uint64_t{1} << 16;
+    auto ap = [](uint8_t n) { return uint64_t{1} << (32 + (n & 0xF)); };
+    // GPRstack に積んだ値の出どころ（0〜15 は呼び出し元の rn のまま）
+    constexpr int8_t Computed = -1; // 引数だけから決まる値
+    constexpr int8_t Mixed = -2;    // 経路によって違う
+    struct State {
+      bool seen = false;
+      uint64_t defined = 0;        // bit n: rn が確定, bit16: フラグが確定, bit 32 + n: apn が確定
+      uint64_t dirty = 0;          // 呼び出し元の値から変わっている可能性があるもの
+      std::vector<int8_t> stack;   // GPRstack の中身
+    };
+    std::vector<State> states(rom.size());
+    std::vector<uint16_t> work;
+    Summary result{0, 0, 0, 0, false};
+    uint64_t defined_at_return = ~uint64_t{0}; // すべての RET で確定しているもの
+    uint64_t dirty_at_return = 0;              // いずれかの RET で変わっている可能性があるもの
+
+    // MLD や呼び出し先が apn を使う。確定していなければ呼び出し元の値（キーに加える）。経路によって違えば純粋でない
+    auto use_ap = [&](uint8_t n, uint64_t defined, uint64_t dirty) {
+      if (defined & ap(n)) {
+        return true;
+      }
+      result.ap_reads |= static_cast<uint16_t>(1u << (n & 0xF));
+      return (dirty & ap(n)) == 0;
+    };
+
+    auto flow = [&](uint16_t to, uint64_t defined, uint64_t dirty, const std::vector<int8_t> &stack) {
+      if (to >= rom.size()) {
+        return false;
+      }
+      State &st = states[to];
+      if (!st.seen) {
+        st = {true, defined, dirty, stack};
+        work.push_back(to);
+        return true;
+      }
+      if (st.stack.size() != stack.size()) {
+        return false; // 経路によって積んだ数が違う
+      }
+      bool changed = (st.defined & defined) != st.defined || (st.dirty | dirty) != st.dirty;
+      st.defined &= defined;
+      st.dirty |= dirty;
+      for (size_t k = 0; k < stack.size(); ++k) {
+        if (st.stack[k] != stack[k] && st.stack[k] != Mixed) {
+          st.stack[k] = Mixed;
+          changed = true;
+        }
+      }
+      if (changed) {
+        work.push_back(to);
+      }
+      return true;
+    };
+    if (!flow(target, 0b11111 | ap(0), 0, {})) {
+      return std::nullopt;
+    }
+
+    while (!work.empty()) {
+      uint16_t pc = work.back();
+      work.pop_back();
+      const Instruction &inst = rom[pc];
+      uint64_t defined = states[pc].defined;
+      uint64_t dirty = states[pc].dirty;
+      std::vector<int8_t> stack = states[pc].stack;
+      size_t depth = stack.size();
+      auto reg = [](uint8_t n) { return uint64_t{1} << (n & 0xF); };
+      uint64_t reads = 0;
+      uint64_t writes = 0;
+      uint16_t next = static_cast<uint16_t>(pc + 1);
+      bool falls_through = true;
+      uint16_t branch = 0;
+      bool branches = false;
+
+      switch (inst.kind) {
+        case InstKind::NOP: break;
+        case InstKind::ALU: reads = reg(inst.a) | reg(inst.b); writes = reg(inst.c) | FlagsBit; break;
+        case InstKind::CMP: reads = reg(inst.a) | reg(inst.b); writes = FlagsBit; break;
+        case InstKind::ADI:
+        case InstKind::SBI:
+        case InstKind::ANI: reads = reg(inst.a); writes = reg(inst.a) | FlagsBit; break;
+        case InstKind::CMI: reads = reg(inst.a); writes = FlagsBit; break;
+        case InstKind::LDI: writes = reg(inst.a); break;
+        case InstKind::MOV: reads = reg(inst.a); writes = reg(inst.b); break;
+        case InstKind::API: writes = ap(inst.a); break;
+        case InstKind::APD: reads = reg(inst.a) | reg(inst.b); writes = ap(inst.c); break;
+        case InstKind::MLD:
+          if (!use_ap(inst.b, defined, dirty)) {
+            return std::nullopt;
+          }
+          result.reads_ram = true;
+          writes = reg(inst.a);
+          break;
+        case InstKind::JMP: falls_through = false; branch = inst.addr; branches = true; break;
+        case InstKind::BRH: reads = FlagsBit; branch = inst.addr; branches = true; break;
+        case InstKind::CAL: {
+          const Summary *callee = summary(rom, inst.addr);
+          if (!callee) {
+            return std::nullopt;
+          }
+          for (uint8_t n = 1; n < 16; ++n) {
+            if (((callee->ap_reads >> n) & 1) && !use_ap(n, defined, dirty)) {
+              return std::nullopt;
+            }
+          }
+          result.reads_ram |= callee->reads_ram;
+          reads = 0b11110;
+          writes = callee->writes;
+          result.call_depth = std::max<uint8_t>(result.call_depth, static_cast<uint8_t>(callee->call_depth + 1));
+          result.stack_depth = std::max<uint8_t>(result.stack_depth, static_cast<uint8_t>(depth + callee->stack_depth));
+          break;
+        }
+        case InstKind::RET:
+          if (depth != 0) {
+            return std::nullopt;
+          }
+          defined_at_return &= defined;
+          dirty_at_return |= dirty;
+          falls_through = false;
+          break;
+        case InstKind::PSH: {
+          uint64_t bit = reg(inst.a);
+          stack.push_back((defined & bit) ? Computed : (dirty & bit) ? Mixed : static_cast<int8_t>(inst.a & 0xF));
+          result.stack_depth = std::max<uint8_t>(result.stack_depth, static_cast<uint8_t>(stack.size()));
+          break;
+        }
+        case InstKind::POP: {
+          if (stack.empty()) {
+            return std::nullopt; // 呼び出し元が積んだ値を読む
+          }
+          int8_t origin = stack.back();
+          stack.pop_back();
+          uint64_t bit = reg(inst.a);
+          if (origin == Computed) {
+            writes = bit;
+          } else if (origin == static_cast<int8_t>(inst.a & 0xF)) {
+            // 退避した呼び出し元の値をそのまま戻した
+            defined &= ~bit;
+            dirty &= ~bit;
+          } else if ((inst.a & 0xF) != 0) {
+            return std::nullopt; // 呼び出し元の別のレジスタの値や、経路によって違う値が残る
+          }
+          break;
+        }
+        default: // MST / PLD / PST / HLT / TRAP
+          return std::nullopt;
+      }
+      if ((reads & ~defined) != 0) {
+        return std::nullopt;
+      }
+      writes &= ~(1u | ap(0)); // r0 / ap0 への書き込みは捨てられる
+      defined |= writes;
+      dirty |= writes;
+      if ((falls_through && !flow(next, defined, dirty, stack)) || (branches && !flow(branch, defined, dirty, stack))) {
+        return std::nullopt;
+      }
+    }
+    if (result.call_depth >= Config::CallStackDepth || result.stack_depth > Config::GPRStackDepth) {
+      return std::nullopt;
+    }
+    // 経路によって書いたり書かなかったりするものは、戻り値が呼び出し元の値に依存する
+    if ((dirty_at_return & ~defined_at_return) != 0) {
+      return std::nullopt;
+    }
+    result.writes = dirty_at_return;
+    return result;
+  }
+};
+
+// CPUコア（構成はすべてコンフィグ型からコンパイル時に決まる。ALU の実装は差し替え可能）
+template <typename Config, typename ALUType = ALU<Config>>
+class CPU {
+public:
+  using config = Config;
+
+  ALUType alu; // alu.flags がフラグレジスタ
+  Register<Config> regs;
+  Register<Config, Config::ApCount, true> aps; // ap0 は常に 0x00 を指すゼロポインタ
+  std::array<uint8_t, Config::RAMSize> ram{};
+  std::array<uint8_t, Config::PortCount> in_ports{};
+  std::array<uint8_t, Config::PortCount> out_ports{};
+  HardwareStack<uint16_t, Config::CallStackDepth> call_stack; // 戻りアドレス（10bit）
+  HardwareStack<uint8_t, Config::GPRStackDepth> gpr_stack;
+  uint16_t pc = 0;
+  bool halted = false;
+  const char* fault = nullptr; // スタックのあふれなどで停止した理由
+  uint64_t retired = 0;        // 実行した命令の累計（TRAP は数えない）
+  Memoizer<Config> *memo = nullptr; // 設定すると純粋なサブルーチンの呼び出しをメモ化する
+  BranchProfile *branches = nullptr; // 設定すると BRH ごとに成立・不成立を数える（その間 memo は使わない）
+  bool trapped = false;        // TRAP で止まった（pc は TRAP の位置のまま）
+  WatchTable ram_watch;        // MLD / MST が調べる
+  WatchTable port_watch;       // PLD / PST が調べる（ポート番号は PortCount で折り返した値）
+  bool watch_stop = false;     // ウォッチポイントに当たった命令の直後で止まった
+  WatchHit watch_hit{};
+
+  // MCL / RCL / ACL 相当の初期化
+  void reset() {
+    ram.fill(0);
+    out_ports.fill(0);
+    regs.reg_clear();
+    aps.reg_clear();
+    call_stack.clear();
+    gpr_stack.clear();
+    pc = 0;
+    halted = false;
+    fault = nullptr;
+    retired = 0;
+    trapped = false;
+    watch_stop = false;
+    if (memo) {
+      memo->abandon();
+      memo->forget_ram();
+    }
+  }
+
+  CPUState<Config> save() const {
+    CPUState<Config> state;
+    state.regs = regs.dump();
+    state.aps = aps.dump();
+    state.ram = ram;
+    state.in_ports = in_ports;
+    state.out_ports = out_ports;
+    state.call_stack = call_stack;
+    state.gpr_stack = gpr_stack;
+    state.flags = alu.flags;
+    state.pc = pc;
+    state.halted = halted;
+    return state;
+  }
+
+  void restore(const CPUState<Config> &state) {
+    regs.load(state.regs);
+    aps.load(state.aps);
+    ram = state.ram;
+    in_ports = state.in_ports;
+    out_ports = state.out_ports;
+    call_stack = state.call_stack;
+    gpr_stack = state.gpr_stack;
+    alu.flags = state.flags;
+    pc = state.pc;
+    halted = state.halted;
+    fault = nullptr;
+    trapped = false;
+    if (memo) {
+      memo->abandon();
+      memo->forget_ram();
+    }
+  }
+
+  // pc の命令を1つ実行
+  void step(const Program &rom) {
+    PROFILE_SCOPE(Dispatch);
+    if (halted) {
+      return;
+    }
+    if (pc >= rom.size()) {
+      stop("PC outside ROM");
+      return;
+    }
+    const Instruction &inst = rom[pc];
+    uint16_t next = static_cast<uint16_t>((pc + 1) & 0x3FF);
+
+    switch (inst.kind) {
+      case InstKind::NOP:
+        break;
+      case InstKind::ALU: {
+        auto [x, y] = regs.reg_read(inst.a, inst.b);
+        alu.execute(x, y, inst.alu_op);
+        regs.reg_write(inst.c, alu.result);
+        break;
+      }
+      case InstKind::CMP: {
+        auto [x, y] = regs.reg_read(inst.a, inst.b);
+        alu.execute(x, y, Opcode::SUB);
+        break;
+      }
+      case InstKind::ADI:
+        alu.execute(regs.reg_read(inst.a), inst.b, Opcode::ADD);
+        regs.reg_write(inst.a, alu.result);
+        break;
+      case InstKind::SBI:
+        alu.execute(regs.reg_read(inst.a), inst.b, Opcode::SUB);
+        regs.reg_write(inst.a, alu.result);
+        break;
+      case InstKind::ANI:
+        alu.execute(regs.reg_read(inst.a), inst.b, Opcode::AND);
+        regs.reg_write(inst.a, alu.result);
+        break;
+      case InstKind::CMI:
+        alu.execute(regs.reg_read(inst.a), inst.b, Opcode::SUB);
+        break;
+      case InstKind::LDI:
+        regs.reg_write(inst.a, inst.b);
+        break;
+      case InstKind::MOV:
+        regs.reg_write(inst.b, regs.reg_read(inst.a));
+        break;
+      case InstKind::API:
+        aps.reg_write(inst.a, inst.b);
+        break;
+      case InstKind::APD: {
+        auto [x, y] = regs.reg_read(inst.a, inst.b);
+        aps.reg_write(inst.c, static_cast<uint8_t>(x + y));
+        break;
+      }
+      case InstKind::MLD: {
+        PROFILE_SCOPE(IO);
+        uint8_t addr = static_cast<uint8_t>((aps.reg_read(inst.b) + inst.c) % Config::RAMSize);
+        uint8_t value = ram[addr];
+        if (ram_watch.watched(addr)) {
+          watch(WatchSpace::RAM, ram_watch, addr, value, value, false);
+        }
+        if (memo) {
+          memo->read(addr);
+        }
+        regs.reg_write(inst.a, value);
+        break;
+      }
+      case InstKind::MST: {
+        PROFILE_SCOPE(IO);
+        uint8_t addr = static_cast<uint8_t>((aps.reg_read(inst.b) + inst.c) % Config::RAMSize);
+        uint8_t value = regs.reg_read(inst.a);
+        if (ram_watch.watched(addr)) {
+          watch(WatchSpace::RAM, ram_watch, addr, ram[addr], value, true);
+        }
+        if (memo) {
+          memo->write(addr);
+        }
+        ram[addr] = value;
+        break;
+      }
+      case InstKind::PLD: {
+        PROFILE_SCOPE(IO);
+        uint8_t port = static_cast<uint8_t>((aps.reg_read(inst.b) + inst.c) % Config::PortCount);
+        uint8_t value = in_ports[port];
+        if (port_watch.watched(port)) {
+          watch(WatchSpace::Port, port_watch, port, value, value, false);
+        }
+        regs.reg_write(inst.a, value);
+        break;
+      }
+      case InstKind::PST: {
+        PROFILE_SCOPE(IO);
+        uint8_t port = static_cast<uint8_t>((aps.reg_read(inst.b) + inst.c) % Config::PortCount);
+        uint8_t value = regs.reg_read(inst.a);
+        if (port_watch.watched(port)) {
+          watch(WatchSpace::Port, port_watch, port, out_ports[port], value, true);
+        }
+        out_ports[port] = value;
+        break;
+      }
+      case InstKind::JMP:
+        next = inst.addr;
+        break;
+      case InstKind::BRH: {
+        bool taken = condition(static_cast<Cond>(inst.a & 0b11));
+        if (branches) {
+          branches->record(pc, taken);
+        }
+        if (taken) {
+          next = inst.addr;
+        }
+        break;
+      }
+      case InstKind::CAL:
+        // メモ化が当たると呼び出し先の BRH を数えられないので、分岐プロファイル中は実行する
+        if (memo && !branches && call_memoized(rom, inst.addr)) {
+          break; // 結果を書き戻したので次の命令へ
+        }
+        if (!call_stack.push(next)) {
+          stop("CALstack overflow");
+          return;
+        }
+        next = inst.addr;
+        break;
+      case InstKind::RET:
+        if (!call_stack.pop(next)) {
+          stop("CALstack underflow");
+          return;
+        }
+        if (memo && memo->recording(call_stack.size())) {
+          memo->finish(regs.dump(), aps.dump(), alu.flags, retired + 1);
+        }
+        break;
+      case InstKind::PSH:
+        if (!gpr_stack.push(regs.reg_read(inst.a))) {
+          stop("GPRstack overflow");
+          return;
+        }
+        break;
+      case InstKind::POP: {
+        uint8_t value = 0;
+        if (!gpr_stack.pop(value)) {
+          stop("GPRstack underflow");
+          return;
+        }
+        regs.reg_write(inst.a, value);
+        break;
+      }
+      case InstKind::HLT:
+        halted = true;
+        ++retired;
+        return;
+      case InstKind::TRAP:
+        // halted を立てて run のループを抜ける（ブレークポイントがなければ実行ループの判定は増えない）
+        halted = true;
+        trapped = true;
+        return;
+    }
+    pc = next;
+    ++retired;
+  }
+
+  // HLT・異常停止・命令数の上限まで実行し、実行した命令数を返す
+  uint64_t run(const Program &rom, uint64_t max_steps) {
+    uint64_t steps = 0;
+    while (!halted && steps < max_steps) {
+      step(rom);
+      ++steps;
+    }
+    return steps;
+  }
+
+  // run と同じだが、publish_interval 命令ごとに状態を monitor へ公開する
+  uint64_t run(const Program &rom, uint64_t max_steps, SeqLock<MonitorSample<Config>> &monitor, uint64_t publish_interval = 4096) {
+    MonitorSample<Config> sample;
+    uint64_t steps = 0;
+    while (!halted && steps < max_steps) {
+      uint64_t chunk = std::min(publish_interval, max_steps - steps);
+      steps += run(rom, chunk);
+      sample.state = save();
+      sample.steps = retired;
+      monitor.store(sample);
+    }
+    return steps;
+  }
+
+  bool condition(Cond cond) const {
+    switch (cond) {
+      case Cond::Z:  return (alu.flags & Flags::Z) != 0;
+      case Cond::NZ: return (alu.flags & Flags::NZ) != 0;
+      case Cond::C:  return (alu.flags & Flags::C) != 0;
+      case Cond::NC: return (alu.flags & Flags::NC) != 0;
+    }
+    return false;
+  }
+
+private:
+  void stop(const char* reason) {
+    halted = true;
+    fault = reason;
+  }
+
+  // メモ化された呼び出しなら結果を書き戻して true。外れたら記録を始めて false
+  bool call_memoized(const Program &rom, uint16_t target) {
+    if constexpr (Config::RegCount < 16) {
+      return false;
+    }
+    const auto *summary = memo->summary(rom, target);
+    if (!summary) {
+      return false;
+    }
+    // 省略すると RAM のウォッチポイントに当たらなくなるので、ウォッチ中は RAM を読む呼び出しを実行する
+    if (summary->reads_ram && std::any_of(ram_watch.mask.begin(), ram_watch.mask.end(), [](uint64_t w) { return w != 0; })) {
+      return false;
+    }
+    // 実際に実行したらスタックがあふれる呼び出しは、そのまま実行して同じ停止理由にする
+    if (call_stack.size() + 1 + summary->call_depth > Config::CallStackDepth ||
+        gpr_stack.size() + summary->stack_depth > Config::GPRStackDepth) {
+      return false;
+    }
+    const auto &r = regs.dump();
+    uint32_t args = uint32_t{r[1]} | uint32_t{r[2]} << 8 | uint32_t{r[3]} << 16 | uint32_t{r[4]} << 24;
+    const auto &a = aps.dump();
+    if (const auto *hit = memo->find(*summary, target, args, a)) {
+      std::array<uint8_t, Config::RegCount> values = r;
+      for (size_t n = 1; n < 16; ++n) {
+        if ((summary->writes >> n) & 1) {
+          values[n] = hit->regs[n - 1];
+        }
+      }
+      regs.load(values);
+      if (summary->writes & (1u << 16)) {
+        alu.flags = hit->flags;
+      }
+      if (summary->writes >> 32) {
+        auto ap_values = a;
+        for (size_t n = 1; n < ap_values.size(); ++n) {
+          if ((summary->writes >> (32 + n)) & 1) {
+            ap_values[n] = hit->aps[n];
+          }
+        }
+        aps.load(ap_values);
+      }
+      retired += hit->instructions;
+      if constexpr (Config::UseDelay) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(hit->seconds));
+      }
+      return true;
+    }
+    memo->begin(target, args, a, call_stack.size(), retired + 1);
+    return false;
+  }
+
+  // ウォッチ対象へのアクセス（マスクのビットが立っているときだけ呼ばれる）
+  void watch(WatchSpace space, const WatchTable &table, uint8_t addr, uint8_t old_value, uint8_t new_value, bool write) {
+    uint8_t kinds = table.kinds[addr];
+    uint8_t kind = 0;
+    if (!write && (kinds & WatchKind::Read)) {
+      kind = WatchKind::Read;
+    } else if (write && (kinds & WatchKind::Write)) {
+      kind = WatchKind::Write;
+    } else if (write && (kinds & WatchKind::Change) && old_value != new_value) {
+      kind = WatchKind::Change;
+    }
+    if (kind != 0) {
+      // 命令を最後まで実行してから run のループを抜ける
+      watch_hit = {space, kind, addr, old_value, new_value, pc};
+      watch_stop = true;
+      halted = true;
+    }
+  }
+};
+
+// ターミナル用ダッシュボード（別スレッドで描画し、変化したセルだけを書き換える）
+template <typename Config>
+class Dashboard {
+public:
+  Dashboard(const SeqLock<MonitorSample<Config>> &source, double fps) : source(source), frame(1.0 / fps) {}
+  ~Dashboard() { stop(); }
+
+  void start() {
+    running = true;
+    worker = std::thread([this] { loop(); });
+  }
+
+  void stop() {
+    if (worker.joinable()) {
+      running = false;
+      worker.join();
+      draw(); // 最終状態
+      out += "\033[";
+      out += std::to_string(BottomRow + 1);
+      out += ";1H\033[?25h";
+      flush();
+    }
+  }
+
+private:
+  // セル = 画面上の固定位置に出す1つの値
+  struct Cell {
+    uint8_t row;
+    uint8_t col;
+    uint8_t digits;
+  };
+  static constexpr size_t RegBase = 0;
+  static constexpr size_t ApBase = RegBase + Config::RegCount;
+  static constexpr size_t InBase = ApBase + Config::ApCount;
+  static constexpr size_t OutBase = InBase + Config::PortCount;
+  static constexpr size_t RamBase = OutBase + Config::PortCount;
+  static constexpr size_t PcCell = RamBase + Config::RAMSize;
+  static constexpr size_t FlagsCell = PcCell + 1;
+  static constexpr size_t CellCount = FlagsCell + 1;
+  static constexpr int RamRow = 9;
+  static constexpr int BottomRow = RamRow + (Config::RAMSize + 15) / 16;
+
+  const SeqLock<MonitorSample<Config>> &source;
+  std::chrono::duration<double> frame;
+  std::atomic<bool> running{false};
+  std::thread worker;
+
+  bool first = true;
+  uint64_t last_version = 0;
+  uint64_t last_steps = 0;
+  std::chrono::steady_clock::time_point last_time;
+  std::array<uint16_t, CellCount> shown{};
+  std::array<bool, CellCount> hot{}; // 直前のフレームで変化した（強調表示中）
+  std::string out;
+
+  void loop() {
+    out += "\033[2J\033[?25l";
+    auto next = std::chrono::steady_clock::now();
+    while (running) {
+      draw();
+      next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(frame);
+      std::this_thread::sleep_until(next);
+    }
+  }
+
+  static Cell cell_at(size_t i) {
+    if (i < ApBase) return {3, static_cast<uint8_t>(5 + 3 * (i - RegBase)), 2};
+    if (i < InBase) return {4, static_cast<uint8_t>(5 + 3 * (i - ApBase)), 2};
+    if (i < OutBase) return {6, static_cast<uint8_t>(5 + 3 * (i - InBase)), 2};
+    if (i < RamBase) return {7, static_cast<uint8_t>(5 + 3 * (i - OutBase)), 2};
+    if (i < PcCell) return {static_cast<uint8_t>(RamRow + (i - RamBase) / 16), static_cast<uint8_t>(5 + 3 * ((i - RamBase) % 16)), 2};
+    if (i == PcCell) return {1, 35, 3};
+    return {1, 47, 2};
+  }
+
+  static uint16_t value_of(const CPUState<Config> &st, size_t i) {
+    if (i < ApBase) return st.regs[i - RegBase];
+    if (i < InBase) return st.aps[i - ApBase];
+    if (i < OutBase) return st.in_ports[i - InBase];
+    if (i < RamBase) return st.out_ports[i - OutBase];
+    if (i < PcCell) return st.ram[i - RamBase];
+    if (i == PcCell) return st.pc;
+    return st.flags;
+  }
+
+  void move_to(int row, int col) {
+    out += "\033[";
+    out += std::to_string(row);
+    out += ';';
+    out += std::to_string(col);
+    out += 'H';
+  }
+
+  void put_hex(uint16_t value, int digits) {
+    static constexpr char hex[] = "0123456789abcdef";
+    for (int shift = 4 * (digits - 1); shift >= 0; shift -= 4) {
+      out += hex[(value >> shift) & 0xF];
+    }
+  }
+
+  void put_label(int row, int col, const std::string &text) {
+    move_to(row, col);
+    out += Colors::DIM;
+    out += text;
+    out += Colors::RESET;
+  }
+
+  void draw_layout() {
+    move_to(1, 1);
+    out += Colors::CYAN;
+    out += Colors::BOLD;
+    out += "CPUVM [";
+    out += Config::Name;
+    out += "]";
+    out += Colors::RESET;
+    put_label(1, 31, "pc");
+    put_label(1, 41, "flags");
+    put_label(3, 1, "r");
+    put_label(4, 1, "ap");
+    put_label(6, 1, "in");
+    put_label(7, 1, "out");
+    for (size_t row = 0; row < (Config::RAMSize + 15) / 16; ++row) {
+      move_to(RamRow + static_cast<int>(row), 1);
+      out += Colors::DIM;
+      put_hex(static_cast<uint16_t>(row * 16), 2);
+      out += ':';
+      out += Colors::RESET;
+    }
+  }
+
+  void draw() {
+    PROFILE_SCOPE(Trace);
+    MonitorSample<Config> sample;
+    uint64_t version = source.load(sample);
+    if (!first && version == last_version) {
+      return; // VM がまだ何も公開していない / 停止済み
+    }
+    if (first) {
+      draw_layout();
+    }
+
+    for (size_t i = 0; i < CellCount; ++i) {
+      uint16_t value = value_of(sample.state, i);
+      bool changed = first || value != shown[i];
+      if (!changed && !hot[i]) {
+        continue;
+      }
+      Cell c = cell_at(i);
+      move_to(c.row, c.col);
+      if (changed && !first) {
+        out += Colors::YELLOW;
+        out += Colors::BOLD;
+        put_hex(value, c.digits);
+        out += Colors::RESET;
+      } else {
+        put_hex(value, c.digits);
+      }
+      shown[i] = value;
+      hot[i] = changed && !first;
+    }
+
+    // 実行速度（前フレームからの命令数）
+    auto now = std::chrono::steady_clock::now();
+    if (!first) {
+      double seconds = std::chrono::duration<double>(now - last_time).count();
+      move_to(1, 55);
+      out += Colors::GREEN;
+      out += std::to_string(sample.steps);
+      out += " steps  ";
+      out += std::to_string(static_cast<uint64_t>((sample.steps - last_steps) / std::max(seconds, 1e-9) / 1e6));
+      out += " MIPS";
+      out += sample.state.halted ? "  HALT" : "";
+      out += Colors::RESET;
+      out += "\033[K";
+    }
+    last_time = now;
+    last_steps = sample.steps;
+    last_version = version;
+    first = false;
+    flush();
+  }
+
+  void flush() {
+    std::cout.write(out.data(), static_cast<std::streamsize>(out.size()));
+    std::cout.flush();
+    out.clear();
+  }
+};
+
+// ホストスレッド用のバリア
+class Barrier {
+public:
+  explicit Barrier(size_t count) : count(count) {}
+
+  void arrive_and_wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t gen = generation;
+    if (++waiting == count) {
+      waiting = 0;
+      ++generation;
+      cv.notify_all();
+    } else {
+      cv.wait(lock, [&] { return gen != generation; });
+    }
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t count;
+  size_t waiting = 0;
+  uint64_t generation = 0;
+};
+
+// 複数コアの試作（RAM と I/O ポートを共有し、量子単位で決定的に同期する）
+template <typename Config>
+class MultiCore {
+public:
+  static constexpr size_t MaxCores = 64; // 調停のビットマスク幅
+
+  struct Options {
+    size_t cores = 4;
+    uint64_t quantum = 64;    // バリアまでに各コアが実行する命令数
+    uint32_t mem_latency = 2; // 競合1段あたりの待ちサイクル
+    unsigned threads = 0;     // ホストスレッド数（0: コア数）
+  };
+
+  struct CoreStats {
+    uint64_t instructions = 0;
+    uint64_t stall_cycles = 0;
+    uint64_t accesses = 0;
+    uint64_t conflicts = 0; // 調停で後回しにされた回数
+  };
+
+  std::array<uint8_t, Config::RAMSize> ram{};
+  std::array<uint8_t, Config::PortCount> in_ports{};
+  std::array<uint8_t, Config::PortCount> out_ports{};
+  std::vector<CoreStats> stats;
+  std::array<uint64_t, Config::RAMSize> ram_conflicts{};
+  std::array<uint64_t, Config::PortCount> port_conflicts{};
+  uint64_t quanta = 0;
+  uint64_t hash = 14695981039346656037ULL; // 量子ごとの共有状態の FNV-1a（再現性の確認用）
+
+  MultiCore(const Program &rom, Options options) : rom(rom), options(options) {
+    if (options.cores == 0 || options.cores > MaxCores) {
+      std::cerr << "Error: Core count must be between 1 and " << MaxCores << ". Terminate." << std::endl;
+      exit(1);
+    }
+    for (size_t i = 0; i < options.cores; ++i) {
+      cores.push_back(std::make_unique<CPU<Config>>());
+      cores.back()->regs.reg_write(1, static_cast<uint8_t>(i));
+    }
+    stats.resize(options.cores);
+    logs.resize(options.cores);
+  }
+
+  CPU<Config> &core(size_t i) { return *cores[i]; }
+
+  bool all_halted() const {
+    return std::all_of(cores.begin(), cores.end(), [](const auto &c) { return c->halted; });
+  }
+
+  // 全コアの停止か max_quanta まで実行
+  void run(uint64_t max_quanta) {
+    size_t threads = options.threads == 0 ? options.cores : std::min<size_t>(options.threads, options.cores);
+    auto share = [this] {
+      for (auto &c : cores) {
+        c->ram = ram;
+        c->in_ports = in_ports;
+        c->out_ports = out_ports;
+      }
+    };
+    // ホストスレッドが1本なら、スレッドを作らずにこのスレッドで順に実行する
+    if (threads == 1) {
+      for (uint64_t q = 0; q < max_quanta && !all_halted(); ++q) {
+        share();
+        for (size_t i = 0; i < cores.size(); ++i) {
+          run_quantum(i);
+        }
+        merge();
+      }
+      return;
+    }
+    Barrier start(threads + 1);
+    Barrier done(threads + 1);
+    bool finished = false;
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; ++t) {
+      pool.emplace_back([&, t] {
+        while (true) {
+          start.arrive_and_wait();
+          if (finished) {
+            return;
+          }
+          for (size_t i = t; i < cores.size(); i += threads) {
+            run_quantum(i);
+          }
+          done.arrive_and_wait();
+        }
+      });
+    }
+
+    for (uint64_t q = 0; q < max_quanta && !all_halted(); ++q) {
+      share();
+      start.arrive_and_wait();
+      done.arrive_and_wait();
+      merge();
+    }
+    finished = true;
+    start.arrive_and_wait();
+    for (std::thread &th : pool) {
+      th.join();
+    }
+  }
+
+  void print_report() const {
+    std::cout << Colors::YELLOW << "--- Contention report (" << options.cores << " cores, quantum " << options.quantum
+              << ", latency " << options.mem_latency << ") ---" << Colors::RESET << std::endl;
+    for (size_t i = 0; i < stats.size(); ++i) {
+      const CoreStats &st = stats[i];
+      std::cout << "  core " << i << ": " << st.instructions << " instructions, " << st.accesses << " accesses, "
+                << st.conflicts << " conflicts, " << st.stall_cycles << " stall cycles, "
+                << st.instructions + st.stall_cycles << " cycles" << (cores[i]->halted ? "" : " (running)") << "\n";
+    }
+    std::vector<size_t> hot;
+    for (size_t a = 0; a < Config::RAMSize; ++a) {
+      if (ram_conflicts[a] != 0) {
+        hot.push_back(a);
+      }
+    }
+    std::sort(hot.begin(), hot.end(), [this](size_t x, size_t y) { return ram_conflicts[x] > ram_conflicts[y]; });
+    for (size_t k = 0; k < std::min<size_t>(hot.size(), 5); ++k) {
+      std::cout << "  ram[" << hot[k] << "]: " << ram_conflicts[hot[k]] << " contended quanta\n";
+    }
+    for (size_t p = 0; p < Config::PortCount; ++p) {
+      if (port_conflicts[p] != 0) {
+        std::cout << "  port[" << p << "]: " << port_conflicts[p] << " contended quanta\n";
+      }
+    }
+    std::cout << "  " << quanta << " quanta, state hash " << std::hex << hash << std::dec << "\n";
+  }
+
+private:
+  struct Access {
+    WatchSpace space;
+    uint8_t addr;
+    bool write;
+  };
+
+  const Program &rom;
+  Options options;
+  std::vector<std::unique_ptr<CPU<Config>>> cores;
+  std::vector<std::vector<Access>> logs; // コアごとの今の量子のメモリアクセス
+
+  // コア i を1量子ぶん実行（各コアは自分の写しにしか触れないので、コアどうしは同期不要）
+  void run_quantum(size_t i) {
+    CPU<Config> &c = *cores[i];
+    std::vector<Access> &log = logs[i];
+    log.clear();
+    uint64_t steps = 0;
+    for (; steps < options.quantum && !c.halted; ++steps) {
+      if (c.pc < rom.size()) {
+        const Instruction &inst = rom[c.pc];
+        bool ram_op = inst.kind == InstKind::MLD || inst.kind == InstKind::MST;
+        bool port_op = inst.kind == InstKind::PLD || inst.kind == InstKind::PST;
+        if (ram_op || port_op) {
+          uint8_t addr = static_cast<uint8_t>(c.aps.dump()[inst.b] + inst.c);
+          log.push_back({ram_op ? WatchSpace::RAM : WatchSpace::Port,
+                         static_cast<uint8_t>(addr % (ram_op ? Config::RAMSize : Config::PortCount)),
+                         inst.kind == InstKind::MST || inst.kind == InstKind::PST});
+        }
+      }
+      c.step(rom);
+    }
+    stats[i].instructions += steps;
+    stats[i].accesses += log.size();
+  }
+
+  // 量子の終わり: 競合を調停し、書き込みを調停順に共有メモリへ反映する（後の書き込みが勝つ）
+  void merge() {
+    std::array<uint64_t, Config::RAMSize> ram_users{}, ram_writers{};
+    std::array<uint64_t, Config::PortCount> port_users{}, port_writers{};
+    for (size_t i = 0; i < cores.size(); ++i) {
+      uint64_t bit = uint64_t{1} << i;
+      for (const Access &a : logs[i]) {
+        auto &users = a.space == WatchSpace::RAM ? ram_users[a.addr] : port_users[a.addr];
+        auto &writers = a.space == WatchSpace::RAM ? ram_writers[a.addr] : port_writers[a.addr];
+        users |= bit;
+        if (a.write) {
+          writers |= bit;
+        }
+      }
+    }
+
+    size_t first = quanta % cores.size(); // 量子ごとに優先順位を巡回
+    auto arbitrate = [&](uint64_t users, uint64_t writers, uint64_t &conflicts, auto &&commit) {
+      if (users & (users - 1)) {
+        ++conflicts;
+      }
+      size_t position = 0;
+      for (size_t k = 0; k < cores.size(); ++k) {
+        size_t i = (first + k) % cores.size();
+        if (!((users >> i) & 1)) {
+          continue;
+        }
+        if (position > 0) {
+          stats[i].stall_cycles += position * options.mem_latency;
+          ++stats[i].conflicts;
+        }
+        ++position;
+        if ((writers >> i) & 1) {
+          commit(i);
+        }
+      }
+    };
+    for (size_t a = 0; a < Config::RAMSize; ++a) {
+      if (ram_users[a]) {
+        arbitrate(ram_users[a], ram_writers[a], ram_conflicts[a], [&](size_t i) { ram[a] = cores[i]->ram[a]; });
+      }
+    }
+    for (size_t p = 0; p < Config::PortCount; ++p) {
+      if (port_users[p]) {
+        arbitrate(port_users[p], port_writers[p], port_conflicts[p], [&](size_t i) { out_ports[p] = cores[i]->out_ports[p]; });
+      }
+    }
+
+    ++quanta;
+    auto mix = [this](uint8_t byte) { hash = (hash ^ byte) * 1099511628211ULL; };
+    for (uint8_t v : ram) mix(v);
+    for (uint8_t v : out_ports) mix(v);
+    for (const auto &c : cores) {
+      mix(static_cast<uint8_t>(c->pc));
+      mix(static_cast<uint8_t>(c->pc >> 8));
+    }
+  }
+};
+
+// 出力ポートへの書き込み1回
+struct OutputEvent {
+  uint8_t port;
+  uint8_t value;
+
+  bool operator==(const OutputEvent &other) const { return port == other.port && value == other.value; }
+};
+
+using OutputTrace = std::vector<OutputEvent>;
+
+// 入力ポートの値の全組み合わせを実行して出力列を比較する
+template <typename Config>
+class InputSweep {
+public:
+  using Reference = std::function<OutputTrace(const std::vector<uint8_t> &inputs)>;
+
+  // 1ケースの結果（HLT まで実行できなかった場合は stopped に理由が入り、出力列は途中まで）
+  struct Outcome {
+    OutputTrace trace;
+    std::string stopped;
+  };
+
+  struct Mismatch {
+    uint64_t index;
+    OutputTrace expected;
+    Outcome actual;
+  };
+
+  // inputs: ケース番号の下位バイトから順に割り当てる入力ポート
+  InputSweep(const Program &rom, std::vector<uint8_t> inputs, uint64_t max_steps = 1 << 16)
+    : rom(rom), inputs(std::move(inputs)), max_steps(max_steps) {
+    if (this->inputs.empty() || this->inputs.size() > 2) {
+      std::cerr << "Error: Input sweep supports 1 or 2 input ports. Terminate." << std::endl;
+      exit(1);
+    }
+    prepare();
+  }
+
+  uint64_t space() const { return uint64_t{1} << (8 * inputs.size()); }
+
+  // _start を実行し終えるまでに使った命令数（各ケースで省略できる分）
+  uint64_t startup_steps() const { return skipped; }
+
+  std::vector<uint8_t> inputs_of(uint64_t index) const {
+    std::vector<uint8_t> values;
+    for (size_t k = 0; k < inputs.size(); ++k) {
+      values.push_back(static_cast<uint8_t>(index >> (8 * k)));
+    }
+    return values;
+  }
+
+  // 1ケース実行（スナップショットから再開し、出力ポートへの書き込みをウォッチポイントで拾う）
+  Outcome execute(CPU<Config> &cpu, uint64_t index) const {
+    cpu.restore(snapshot);
+    cpu.port_watch = output_watch;
+    std::vector<uint8_t> values = inputs_of(index);
+    for (size_t k = 0; k < inputs.size(); ++k) {
+      cpu.in_ports[inputs[k]] = values[k];
+    }
+    Outcome outcome;
+    uint64_t steps = 0;
+    while (steps < max_steps) {
+      steps += cpu.run(rom, max_steps - steps);
+      if (!cpu.watch_stop) {
+        break;
+      }
+      cpu.watch_stop = false;
+      cpu.halted = false;
+      outcome.trace.push_back({cpu.watch_hit.addr, cpu.watch_hit.new_value});
+    }
+    if (cpu.fault) {
+      outcome.stopped = std::string("fault: ") + cpu.fault;
+    } else if (!cpu.halted) {
+      outcome.stopped = "no HLT within " + std::to_string(max_steps) + " steps";
+    }
+    return outcome;
+  }
+
+  // [begin, end) を threads 本のスレッドで実行し、expected と食い違ったケースを番号順に返す
+  std::vector<Mismatch> run(uint64_t begin, uint64_t end, unsigned threads, const std::function<OutputTrace(uint64_t)> &expected) const {
+    end = std::min(end, space());
+    constexpr uint64_t Chunk = 256;
+    std::atomic<uint64_t> next{begin};
+    std::mutex mutex;
+    std::vector<Mismatch> mismatches;
+    auto worker = [&] {
+      auto cpu = std::make_unique<CPU<Config>>();
+      std::vector<Mismatch> local;
+      for (uint64_t first = next.fetch_add(Chunk); first < end; first = next.fetch_add(Chunk)) {
+        for (uint64_t index = first; index < std::min(first + Chunk, end); ++index) {
+          Outcome actual = execute(*cpu, index);
+          OutputTrace want = expected(index);
+          // 途中で止まったケースは、そこまでの出力が一致していても食い違いとする
+          if (!actual.stopped.empty() || !(actual.trace == want)) {
+            local.push_back({index, std::move(want), std::move(actual)});
+          }
+        }
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      mismatches.insert(mismatches.end(), local.begin(), local.end());
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < std::max(1u, threads); ++t) {
+      pool.emplace_back(worker);
+    }
+    for (std::thread &th : pool) {
+      th.join();
+    }
+    std::sort(mismatches.begin(), mismatches.end(), [](const Mismatch &x, const Mismatch &y) { return x.index < y.index; });
+    return mismatches;
+  }
+
+  std::vector<Mismatch> run(uint64_t begin, uint64_t end, unsigned threads, const Reference &reference) const {
+    return run(begin, end, threads, [&](uint64_t index) { return reference(inputs_of(index)); });
+  }
+
+  // [begin, end) の全ケースで BRH の成立・不成立を数えて合計する（スナップショット以降の分だけ。_start は含まない）
+  BranchProfile profile(uint64_t begin, uint64_t end, unsigned threads) const {
+    end = std::min(end, space());
+    constexpr uint64_t Chunk = 256;
+    std::atomic<uint64_t> next{begin};
+    std::mutex mutex;
+    BranchProfile total;
+    auto worker = [&] {
+      auto cpu = std::make_unique<CPU<Config>>();
+      auto local = std::make_unique<BranchProfile>();
+      cpu->branches = local.get();
+      for (uint64_t first = next.fetch_add(Chunk); first < end; first = next.fetch_add(Chunk)) {
+        for (uint64_t index = first; index < std::min(first + Chunk, end); ++index) {
+          execute(*cpu, index);
+        }
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      total.merge(*local);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < std::max(1u, threads); ++t) {
+      pool.emplace_back(worker);
+    }
+    for (std::thread &th : pool) {
+      th.join();
+    }
+    return total;
+  }
+
+  // ゴールデンファイル: 1行1ケース "入力0 [入力1] -> ポート:値 ..."
+  std::string format_line(uint64_t index, const OutputTrace &trace) const {
+    std::string line;
+    for (uint8_t v : inputs_of(index)) {
+      line += std::to_string(v) + " ";
+    }
+    line += "->";
+    for (const OutputEvent &e : trace) {
+      line += " " + std::to_string(e.port) + ":" + std::to_string(e.value);
+    }
+    return line;
+  }
+
+  // 例: "3 5 -> 0:8 [fault: CALstack overflow]"
+  std::string format_line(uint64_t index, const Outcome &outcome) const {
+    std::string line = format_line(index, outcome.trace);
+    if (!outcome.stopped.empty()) {
+      line += " [" + outcome.stopped + "]";
+    }
+    return line;
+  }
+
+  void write_golden(const std::string &path, uint64_t begin, uint64_t end) const {
+    std::ofstream out(path);
+    if (!out) {
+      std::cerr << "Error: Cannot write " << path << ". Terminate." << std::endl;
+      exit(1);
+    }
+    auto cpu = std::make_unique<CPU<Config>>();
+    for (uint64_t index = begin; index < std::min(end, space()); ++index) {
+      Outcome outcome = execute(*cpu, index);
+      if (!outcome.stopped.empty()) {
+        std::cerr << "Error: Case " << format_line(index, outcome) << " did not halt; golden file is incomplete. Terminate." << std::endl;
+        exit(1);
+      }
+      out << format_line(index, outcome.trace) << "\n";
+    }
+    if (!out.flush()) {
+      std::cerr << "Error: Cannot write " << path << ". Terminate." << std::endl;
+      exit(1);
+    }
+  }
+
+  // ケース番号 -> 期待する出力列
+  std::map<uint64_t, OutputTrace> read_golden(const std::string &path) const {
+    std::ifstream in(path);
+    if (!in) {
+      std::cerr << "Error: Cannot read " << path << ". Terminate." << std::endl;
+      exit(1);
+    }
+    std::map<uint64_t, OutputTrace> golden;
+    std::string line;
+    size_t number = 0;
+    auto fail = [&](const std::string &reason) {
+      std::cerr << "Error: " << path << ":" << number << ": " << reason << ". Terminate." << std::endl;
+      exit(1);
+    };
+    // 0〜255 の10進数
+    auto byte = [&](const std::string &text) {
+      if (text.empty() || text.size() > 3 || !std::all_of(text.begin(), text.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+        fail("'" + text + "' is not a number");
+      }
+      int value = std::stoi(text);
+      if (value > 255) {
+        fail("'" + text + "' is out of range (0-255)");
+      }
+      return static_cast<uint8_t>(value);
+    };
+    while (std::getline(in, line)) {
+      ++number;
+      std::istringstream fields(line);
+      std::string token;
+      if (!(fields >> token)) {
+        continue; // 空行
+      }
+      uint64_t index = 0;
+      for (size_t k = 0; k < inputs.size(); ++k) {
+        if (k > 0 && !(fields >> token)) {
+          fail("expected " + std::to_string(inputs.size()) + " input values");
+        }
+        index |= static_cast<uint64_t>(byte(token)) << (8 * k);
+      }
+      if (!(fields >> token) || token != "->") {
+        fail("expected '->' after the input values");
+      }
+      OutputTrace trace;
+      while (fields >> token) {
+        size_t colon = token.find(':');
+        if (colon == std::string::npos) {
+          fail("expected port:value, got '" + token + "'");
+        }
+        trace.push_back({byte(token.substr(0, colon)), byte(token.substr(colon + 1))});
+      }
+      if (!golden.emplace(index, std::move(trace)).second) {
+        fail("duplicate case");
+      }
+    }
+    return golden;
+  }
+
+private:
+  const Program &rom;
+  std::vector<uint8_t> inputs;
+  uint64_t max_steps;
+  CPUState<Config> snapshot;
+  WatchTable output_watch;
+  uint64_t skipped = 0;
+
+  // 最初の PLD（最初の入力の読み出し）の直前まで実行して状態を保存する
+  void prepare() {
+    for (size_t port = 0; port < Config::PortCount; ++port) {
+      output_watch.set(static_cast<uint8_t>(port), WatchKind::Write);
+    }
+    auto cpu = std::make_unique<CPU<Config>>();
+    while (!cpu->halted && skipped < max_steps && cpu->pc < rom.size() && rom[cpu->pc].kind != InstKind::PLD) {
+      cpu->step(rom);
+      ++skipped;
+    }
+    snapshot = cpu->save();
+  }
+};
+
+// 短い命令列の総当たり探索（入力 r1、出力 r15、一時レジスタ r2）
+class Superoptimizer {
+public:
+  using Function = std::function<uint8_t(uint8_t)>;
+
+  struct Target {
+    std::string name;
+    Function f;
+    Program naive; // 生成器がそのまま出力する命令列（規則のパターンになる）
+  };
+
+  struct Result {
+    std::vector<Program> sequences; // 最短の長さで見つかったもの（辞書順。同じ途中状態を作る命令列は代表だけを経由する）
+    uint64_t candidates = 0;        // テストベクタで評価した命令列の数
+    uint64_t verified = 0;          // 全入力で検証した数
+  };
+
+  static constexpr size_t Vectors = 32;
+  static constexpr size_t MaxLength = 8; // 途中状態の順位（命令の添字の列）を uint64_t に収める上限
+  static constexpr uint8_t Regs[] = {0, 1, 2, 15}; // 探索で使うレジスタ（添字 0..3）
+
+  explicit Superoptimizer(unsigned threads) : threads(std::max(1u, threads)) {
+    // テストベクタ: 境界の値 + 固定のばらけた値
+    constexpr uint8_t edges[] = {0, 1, 2, 3, 0x7F, 0x80, 0x81, 0xFE, 0xFF, 0x0F, 0xF0, 0x55, 0xAA, 0x10, 0x40, 0xC3};
+    for (size_t i = 0; i < Vectors; ++i) {
+      tests[i] = i < sizeof(edges) ? edges[i] : static_cast<uint8_t>(i * 73 + 41);
+    }
+  }
+
+  // テストベクタを指定する（テスト用。ベクタは最後の命令の絞り込みにだけ使う）
+  Superoptimizer(unsigned threads, const std::array<uint8_t, Vectors> &vectors) : threads(std::max(1u, threads)), tests(vectors) {}
+
+  // 長さ1から max_length まで探索し、最初に見つかった長さのものを返す
+  Result search(const Target &target, size_t max_length) const {
+    std::array<uint8_t, Vectors> want;
+    for (size_t i = 0; i < Vectors; ++i) {
+      want[i] = target.f(tests[i]);
+    }
+    bool use_temp = uses_temp(target.naive);
+    std::vector<Instruction> alphabet = candidates(use_temp);
+    max_length = std::min(max_length, MaxLength);
+
+    Result result;
+    for (size_t length = 1; length <= max_length && result.sequences.empty(); ++length) {
+      std::atomic<size_t> next{0};
+      std::atomic<uint64_t> evaluated{0};
+      std::atomic<uint64_t> verified{0};
+      std::mutex mutex;
+      PruneTable seen;
+      std::vector<Found> found;
+      auto worker = [&] {
+        Search s{*this, target, alphabet, want, length, seen};
+        for (size_t first = next.fetch_add(1); first < alphabet.size(); first = next.fetch_add(1)) {
+          s.start(first);
+        }
+        evaluated += s.evaluated;
+        verified += s.verified;
+        std::lock_guard<std::mutex> lock(mutex);
+        found.insert(found.end(), s.found.begin(), s.found.end());
+      };
+      std::vector<std::thread> pool;
+      for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back(worker);
+      }
+      for (std::thread &th : pool) {
+        th.join();
+      }
+      // 探索の途中では、後から代表が見つかる途中状態を刈らずに進むことがある（スレッドの進み方による）。
+      // 探索後の表で、すべての途中状態で代表の命令列を通ったものだけを残すと、結果はスレッド数によらない
+      for (const Found &f : found) {
+        bool canonical = true;
+        for (size_t depth = 0; depth < f.path.size() && canonical; ++depth) {
+          canonical = seen.representative(f.path[depth].first, static_cast<uint8_t>(depth + 1), f.path[depth].second);
+        }
+        if (canonical) {
+          result.sequences.push_back(f.sequence);
+        }
+      }
+      result.candidates += evaluated;
+      result.verified += verified;
+    }
+    std::sort(result.sequences.begin(), result.sequences.end(), [](const Program &x, const Program &y) {
+      return std::lexicographical_compare(x.begin(), x.end(), y.begin(), y.end(), [](const Instruction &a, const Instruction &b) {
+        return std::make_tuple(a.kind, a.alu_op, a.a, a.b, a.c) < std::make_tuple(b.kind, b.alu_op, b.a, b.b, b.c);
+      });
+    });
+    return result;
+  }
+
+  // 全256入力で命令列が target を計算するか（CPU で実行して確かめる）
+  static bool verify(const Program &sequence, const Function &f) {
+    Program rom = sequence;
+    rom.push_back({InstKind::HLT});
+    auto cpu = std::make_unique<CPU<CPUConfig::Fast>>();
+    for (int x = 0; x < 256; ++x) {
+      cpu->reset();
+      cpu->regs.reg_write(1, static_cast<uint8_t>(x));
+      cpu->run(rom, rom.size());
+      if (cpu->regs.reg_read(15) != f(static_cast<uint8_t>(x))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // PEEPHOLE_RULES の1要素（r1 -> $x, r2 -> $t, r15 -> $d）
+  static std::string rule(const Target &target, const Program &sequence) {
+    auto operands = [](const Instruction &inst) {
+      std::string text = disassemble(inst);
+      std::string out;
+      size_t i = 0;
+      while (i < text.size()) {
+        if (text[i] == 'r' && (i == 0 || text[i - 1] == ' ') && i + 1 < text.size() && std::isdigit(static_cast<unsigned char>(text[i + 1]))) {
+          size_t j = i + 1;
+          while (j < text.size() && std::isdigit(static_cast<unsigned char>(text[j]))) ++j;
+          std::string reg = text.substr(i, j - i);
+          out += reg == "r1" ? "$x" : reg == "r2" ? "$t" : reg == "r15" ? "$d" : reg;
+          i = j;
+        } else {
+          out += text[i++];
+        }
+      }
+      return "'" + out + "'";
+    };
+    auto list = [&](const Program &p) {
+      std::string text = "[";
+      for (size_t i = 0; i < p.size(); ++i) {
+        text += (i ? ", " : "") + operands(p[i]);
+      }
+      return text + "]";
+    };
+    // 置き換え後に値が変わりうるもの（一時レジスタ・書き換えた入力・フラグ）は後続で使われないことを条件にする
+    std::string when = "m.flagsDeadAfter()";
+    if (uses_temp(target.naive)) when = "m.isDeadAfter('$t') && " + when;
+    if (writes_reg(sequence, 1) || writes_reg(target.naive, 1)) when = "m.isDeadAfter('$x') && " + when;
+    return "  { name: 'superopt-" + target.name + "', pattern: " + list(target.naive) + ", replace: " + list(sequence) +
+           ", when: (m) => " + when + " },";
+  }
+
+  // 探索する関数と、生成器の素直な命令列
+  static std::vector<Target> builtin_targets() {
+    auto alu = [](Opcode op, uint8_t a, uint8_t b, uint8_t c) { return Instruction{InstKind::ALU, op, a, b, c}; };
+    auto imm = [](InstKind kind, uint8_t a, uint8_t n) { return Instruction{kind, Opcode::ADD, a, n, 0}; };
+    auto mov = [](uint8_t a, uint8_t b) { return Instruction{InstKind::MOV, Opcode::ADD, a, b, 0}; };
+    return {
+      {"not", [](uint8_t x) { return static_cast<uint8_t>(~x); }, {imm(InstKind::LDI, 2, 255), alu(Opcode::XOR, 1, 2, 15)}},
+      {"inc", [](uint8_t x) { return static_cast<uint8_t>(x + 1); }, {mov(1, 15), imm(InstKind::ADI, 15, 1)}},
+      {"dec", [](uint8_t x) { return static_cast<uint8_t>(x - 1); }, {mov(1, 15), imm(InstKind::SBI, 15, 1)}},
+      {"neg", [](uint8_t x) { return static_cast<uint8_t>(-x); }, {imm(InstKind::LDI, 2, 0), alu(Opcode::SUB, 2, 1, 15)}},
+      {"low-nibble", [](uint8_t x) { return static_cast<uint8_t>(x & 0x0F); }, {mov(1, 15), imm(InstKind::ANI, 15, 0x0F)}},
+      {"shl2", [](uint8_t x) { return static_cast<uint8_t>(x << 2); }, {alu(Opcode::ADD, 1, 1, 2), alu(Opcode::ADD, 2, 2, 15)}},
+      {"shr2", [](uint8_t x) { return static_cast<uint8_t>(x >> 2); }, {alu(Opcode::RSH, 1, 0, 2), alu(Opcode::RSH, 2, 0, 15)}},
+      {"mul3", [](uint8_t x) { return static_cast<uint8_t>(x * 3); }, {alu(Opcode::ADD, 1, 1, 2), alu(Opcode::ADD, 2, 1, 15)}},
+      {"mul5", [](uint8_t x) { return static_cast<uint8_t>(x * 5); },
+       {alu(Opcode::ADD, 1, 1, 2), alu(Opcode::ADD, 2, 2, 2), alu(Opcode::ADD, 2, 1, 15)}},
+      {"mul10", [](uint8_t x) { return static_cast<uint8_t>(x * 10); },
+       {alu(Opcode::ADD, 1, 1, 2), alu(Opcode::ADD, 2, 2, 2), alu(Opcode::ADD, 2, 1, 2), alu(Opcode::ADD, 2, 2, 15)}},
+      // OR は NOR + NOT で生成される
+      {"or-one", [](uint8_t x) { return static_cast<uint8_t>(x | 1); },
+       {imm(InstKind::LDI, 2, 1), alu(Opcode::NOR, 1, 2, 15), alu(Opcode::NOR, 15, 0, 15)}},
+      {"shr1-set-top", [](uint8_t x) { return static_cast<uint8_t>((x >> 1) | 0x80); },
+       {imm(InstKind::LDI, 2, 0x80), alu(Opcode::RSH, 1, 0, 15), alu(Opcode::NOR, 15, 2, 15), alu(Opcode::NOR, 15, 0, 15)}},
+      {"clear-low2", [](uint8_t x) { return static_cast<uint8_t>(x & 0xFC); },
+       {imm(InstKind::LDI, 2, 0xFC), alu(Opcode::AND, 1, 2, 15)}},
+      {"sign-mask", [](uint8_t x) { return static_cast<uint8_t>(x & 0x80 ? 0xFF : 0x00); },
+       {mov(1, 15), imm(InstKind::ANI, 15, 0x80), alu(Opcode::RSH, 15, 0, 2), alu(Opcode::RSH, 2, 0, 2), alu(Opcode::RSH, 2, 0, 2),
+        alu(Opcode::RSH, 2, 0, 2), alu(Opcode::RSH, 2, 0, 2), alu(Opcode::RSH, 2, 0, 2), alu(Opcode::RSH, 2, 0, 2),
+        alu(Opcode::SUB, 0, 2, 15)}},
+    };
+  }
+
+private:
+  unsigned threads;
+  std::array<uint8_t, Vectors> tests{};
+
+  // 探索で使う即値
+  static constexpr uint8_t Immediates[] = {1, 2, 3, 4, 7, 8, 15, 16, 127, 128, 240, 254, 255};
+
+  static bool uses_temp(const Program &p) {
+    return std::any_of(p.begin(), p.end(), [](const Instruction &i) {
+      return (i.kind == InstKind::ALU && (i.a == 2 || i.b == 2 || i.c == 2)) || i.a == 2 || (i.kind == InstKind::MOV && i.b == 2);
+    });
+  }
+
+  static bool writes_reg(const Program &p, uint8_t r) {
+    return std::any_of(p.begin(), p.end(), [r](const Instruction &i) {
+      return (i.kind == InstKind::ALU && i.c == r) || (i.kind == InstKind::MOV && i.b == r) ||
+             ((i.kind == InstKind::ADI || i.kind == InstKind::SBI || i.kind == InstKind::ANI || i.kind == InstKind::LDI) && i.a == r);
+    });
+  }
+
+  static std::vector<Instruction> candidates(bool use_temp) {
+    std::vector<Instruction> list;
+    auto usable = [use_temp](size_t r) { return use_temp || Regs[r] != 2; };
+    for (uint8_t op = 0; op < 8; ++op) {
+      bool commutative = op != static_cast<uint8_t>(Opcode::SUB) && op != static_cast<uint8_t>(Opcode::SBC);
+      for (size_t a = 0; a < 4; ++a) {
+        for (size_t b = commutative ? a : 0; b < 4; ++b) {
+          for (size_t c = 1; c < 4; ++c) {
+            if (usable(a) && usable(b) && usable(c)) {
+              list.push_back({InstKind::ALU, static_cast<Opcode>(op), Regs[a], Regs[b], Regs[c]});
+            }
+          }
+        }
+      }
+    }
+    for (InstKind kind : {InstKind::ADI, InstKind::SBI, InstKind::ANI, InstKind::LDI}) {
+      for (size_t a = 1; a < 4; ++a) {
+        for (uint8_t n : Immediates) {
+          if (usable(a)) {
+            list.push_back({kind, Opcode::ADD, Regs[a], n, 0});
+          }
+        }
+      }
+    }
+    for (size_t a = 0; a < 4; ++a) {
+      for (size_t b = 1; b < 4; ++b) {
+        if (a != b && usable(a) && usable(b)) {
+          list.push_back({InstKind::MOV, Opcode::ADD, Regs[a], Regs[b], 0});
+        }
+      }
+    }
+    return list;
+  }
+
+  static size_t index_of(uint8_t reg) { return reg == 15 ? 3 : reg; }
+
+  // 途中状態の指紋 -> 代表の命令列（最も短く、同じ長さなら命令の添字の列が辞書順で最初のもの）
+  // 全スレッドで共有し、シャードごとにロックする
+  class PruneTable {
+  public:
+    // (depth, rank) が代表より後なら false（枝を刈る）。代表より前なら代表を置き換える
+    bool visit(uint64_t h, uint8_t depth, uint64_t rank) {
+      Shard &shard = shards[h % Shards];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto [it, inserted] = shard.best.emplace(h, std::make_pair(depth, rank));
+      if (!inserted) {
+        if (it->second < std::make_pair(depth, rank)) {
+          return false;
+        }
+        it->second = {depth, rank};
+      }
+      return true;
+    }
+
+    bool representative(uint64_t h, uint8_t depth, uint64_t rank) {
+      Shard &shard = shards[h % Shards];
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto it = shard.best.find(h);
+      return it != shard.best.end() && it->second == std::make_pair(depth, rank);
+    }
+
+  private:
+    static constexpr size_t Shards = 64;
+    struct Shard {
+      std::mutex mutex;
+      std::unordered_map<uint64_t, std::pair<uint8_t, uint64_t>> best;
+    };
+    std::array<Shard, Shards> shards;
+  };
+
+  // 見つかった命令列と、途中状態ごとの (指紋, 順位)
+  struct Found {
+    Program sequence;
+    std::vector<std::pair<uint64_t, uint64_t>> path;
+  };
+
+  // 1スレッドぶんの深さ優先探索
+  struct Search {
+    const Superoptimizer &owner;
+    const Target &target;
+    const std::vector<Instruction> &alphabet;
+    const std::array<uint8_t, Vectors> &want;
+    size_t length;
+    PruneTable &seen;
+    std::vector<Found> found;
+    uint64_t evaluated = 0;
+    uint64_t verified = 0;
+
+    ALU<CPUConfig::Fast> alu;
+    Program sequence;
+    std::vector<std::pair<uint64_t, uint64_t>> path; // sequence の各途中状態の (指紋, 順位)
+
+    // 各レジスタの入力 r1 = 0〜255 ごとの値、確定しているレジスタ、書いたがまだ読んでいないレジスタ
+    // （入力は8bit 1つだけなので、途中状態は256通りの値で正確に表せる）
+    struct State {
+      std::array<std::array<uint8_t, 256>, 4> regs;
+      uint8_t defined;
+      uint8_t unread;
+    };
+
+    Search(const Superoptimizer &owner, const Target &target, const std::vector<Instruction> &alphabet,
+           const std::array<uint8_t, Vectors> &want, size_t length, PruneTable &seen)
+      : owner(owner), target(target), alphabet(alphabet), want(want), length(length), seen(seen) {}
+
+    void start(size_t first) {
+      State st{};
+      for (size_t x = 0; x < 256; ++x) {
+        st.regs[1][x] = static_cast<uint8_t>(x);
+      }
+      st.defined = 0b0011; // r0, r1
+      sequence.clear();
+      path.clear();
+      extend(st, first, 0);
+    }
+
+    // rank: ここまでの命令の添字の列を alphabet.size() 進数で表したもの（同じ長さどうしなら辞書順と一致）
+    void extend(const State &before, size_t index, uint64_t rank) {
+      const Instruction &inst = alphabet[index];
+      uint8_t defined = before.defined;
+      uint8_t unread = before.unread;
+      if (!track(defined, unread, inst)) {
+        return;
+      }
+      sequence.push_back(inst);
+      rank = rank * alphabet.size() + index;
+      if (sequence.size() == length) {
+        finish(before, inst, defined, unread);
+      } else {
+        // 途中状態は全256入力で求める（枝刈りで別の関数をまとめてしまわないように）
+        State st = before;
+        st.defined = defined;
+        st.unread = unread;
+        auto &out = st.regs[index_of(dest_of(inst))];
+        for (size_t x = 0; x < 256; ++x) {
+          out[x] = value(before, inst, x);
+        }
+        uint64_t h = fingerprint(st);
+        if (seen.visit(h, static_cast<uint8_t>(sequence.size()), rank)) {
+          path.push_back({h, rank});
+          for (size_t next = 0; next < alphabet.size(); ++next) {
+            extend(st, next, rank);
+          }
+          path.pop_back();
+        }
+      }
+      sequence.pop_back();
+    }
+
+    static uint8_t dest_of(const Instruction &inst) {
+      return inst.kind == InstKind::ALU ? inst.c : inst.kind == InstKind::MOV ? inst.b : inst.a;
+    }
+
+    // 読み書きの規則だけを適用。読む前に書かれていない・上書きで捨てられる命令なら false
+    static bool track(uint8_t &defined, uint8_t &unread, const Instruction &inst) {
+      auto read = [&](uint8_t reg) {
+        size_t r = index_of(reg);
+        unread &= static_cast<uint8_t>(~(1u << r));
+        return (defined >> r) & 1;
+      };
+      auto write = [&](uint8_t reg) {
+        size_t r = index_of(reg);
+        if ((unread >> r) & 1) {
+          return false; // 直前の書き込みが読まれずに上書きされる
+        }
+        defined |= static_cast<uint8_t>(1u << r);
+        unread |= static_cast<uint8_t>(1u << r);
+        return true;
+      };
+      switch (inst.kind) {
+        case InstKind::ALU: return read(inst.a) && read(inst.b) && write(inst.c);
+        case InstKind::ADI:
+        case InstKind::SBI:
+        case InstKind::ANI:
+          if (!read(inst.a)) return false;
+          unread |= static_cast<uint8_t>(1u << index_of(inst.a));
+          return true;
+        case InstKind::LDI: return write(inst.a);
+        case InstKind::MOV: return read(inst.a) && write(inst.b);
+        default: return false;
+      }
+    }
+
+    // 入力 x のとき inst が書く値
+    uint8_t value(const State &st, const Instruction &inst, size_t x) {
+      const auto &ra = st.regs[index_of(inst.a)];
+      switch (inst.kind) {
+        case InstKind::ALU:
+          alu.compute(ra[x], st.regs[index_of(inst.b)][x], inst.alu_op);
+          return alu.result;
+        case InstKind::ADI: alu.compute(ra[x], inst.b, Opcode::ADD); return alu.result;
+        case InstKind::SBI: alu.compute(ra[x], inst.b, Opcode::SUB); return alu.result;
+        case InstKind::ANI: alu.compute(ra[x], inst.b, Opcode::AND); return alu.result;
+        case InstKind::LDI: return inst.b;
+        default: return ra[x]; // MOV
+      }
+    }
+
+    // 途中状態の指紋（確定しているレジスタの全256入力の値。同じ指紋の途中状態は代表の命令列だけを先へ伸ばす）
+    uint64_t fingerprint(const State &st) const {
+      uint64_t h = 14695981039346656037ULL;
+      auto mix = [&h](uint8_t byte) { h = (h ^ byte) * 1099511628211ULL; };
+      mix(st.defined);
+      mix(st.unread);
+      for (size_t r = 1; r < 4; ++r) {
+        if ((st.defined >> r) & 1) {
+          for (uint8_t v : st.regs[r]) mix(v);
+        }
+      }
+      return h;
+    }
+
+    // 最後の命令はテストベクタの入力でだけ求め、一致したら CPU で全入力を検証する
+    void finish(const State &before, const Instruction &inst, uint8_t defined, uint8_t unread) {
+      ++evaluated;
+      // 最後の命令が r15 を書き、r15 以外に読まれない書き込みが残っていないこと
+      if (!((defined >> 3) & 1) || (unread & ~0b1000) != 0 || !((unread >> 3) & 1) || dest_of(inst) != 15) {
+        return;
+      }
+      for (size_t i = 0; i < Vectors; ++i) {
+        if (value(before, inst, owner.tests[i]) != want[i]) {
+          return;
+        }
+      }
+      ++verified;
+      if (verify(sequence, target.f)) {
+        found.push_back({sequence, path});
+      }
+    }
+  };
+};
+
+// 入力スイープのデモ用プログラム（_start で RAM を初期化し、port 0 / 1 の入力から3つの値を出力する）
+inline Program sweep_demo_program() {
+  return {
+    // _start: ap14 = 0xFF, RAM を 0 で埋める
+    {InstKind::API, Opcode::ADD, 14, 0xFF, 0},                              // 0: ap14 = 0xff
+    {InstKind::LDI, Opcode::ADD, 5, 0, 0},                                  // 1: r5 = 0
+    {InstKind::APD, Opcode::ADD, 5, 0, 1},                                  // 2: ap1 = r5
+    {InstKind::MST, Opcode::ADD, 0, 1, 0},                                  // 3: [ap1 + 0] = 0
+    {InstKind::ADI, Opcode::ADD, 5, 1, 0},                                  // 4: r5 += 1
+    {InstKind::BRH, Opcode::ADD, static_cast<uint8_t>(Cond::NZ), 0, 0, 2}, // 5: 一周するまで 2 へ
+    // main: Input(0, a); Input(1, b); Output(0, a + b); Output(1, (a | b) >> 1); if (a >= b) Output(2, a)
+    {InstKind::PLD, Opcode::ADD, 1, 0, 0},                                  // 6: r1 = port[0]
+    {InstKind::PLD, Opcode::ADD, 2, 0, 1},                                  // 7: r2 = port[1]
+    {InstKind::ALU, Opcode::ADD, 1, 2, 3},                                  // 8: r3 = r1 + r2
+    {InstKind::PST, Opcode::ADD, 3, 0, 0},                                  // 9: port[0] = r3
+    {InstKind::ALU, Opcode::RSH, 1, 2, 4},                                  // 10: r4 = (r1 | r2) >> 1
+    {InstKind::PST, Opcode::ADD, 4, 0, 1},                                  // 11: port[1] = r4
+    {InstKind::CMP, Opcode::ADD, 1, 2, 0},                                  // 12: r1 - r2
+    {InstKind::BRH, Opcode::ADD, static_cast<uint8_t>(Cond::NC), 0, 0, 15}, // 13: 借りがあれば 15 へ
+    {InstKind::PST, Opcode::ADD, 1, 0, 2},                                  // 14: port[2] = r1
+    {InstKind::HLT},                                                        // 15
+  };
+}
+
+// sweep_demo_program の参照実装
+inline OutputTrace sweep_demo_reference(const std::vector<uint8_t> &in) {
+  uint8_t a = in[0];
+  uint8_t b = in[1];
+  OutputTrace out = {{0, static_cast<uint8_t>(a + b)}, {1, static_cast<uint8_t>((a | b) >> 1)}};
+  if (a >= b) {
+    out.push_back({2, a});
+  }
+  return out;
+}
+
+// マルチコアのデモ用プログラム（全コアが ram[0] を排他制御なしで100回ずつ加算する）
+inline Program multicore_demo_program() {
+  return {
+    {InstKind::API, Opcode::ADD, 1, 0x00, 0},                               // 0: ap1 = 0x00
+    {InstKind::LDI, Opcode::ADD, 2, 0, 0},                                  // 1: r2 = 0
+    {InstKind::MLD, Opcode::ADD, 3, 1, 0},                                  // 2: r3 = [ap1 + 0]
+    {InstKind::ADI, Opcode::ADD, 3, 1, 0},                                  // 3: r3 += 1
+    {InstKind::MST, Opcode::ADD, 3, 1, 0},                                  // 4: [ap1 + 0] = r3
+    {InstKind::ADI, Opcode::ADD, 2, 1, 0},                                  // 5: r2 += 1
+    {InstKind::CMI, Opcode::ADD, 2, 100, 0},                                // 6: r2 - 100
+    {InstKind::BRH, Opcode::ADD, static_cast<uint8_t>(Cond::NZ), 0, 0, 2}, // 7: r2 != 100 なら 2 へ
+    {InstKind::HLT},                                                        // 8
+  };
+}
+
+// ダッシュボードのデモ用プログラム（RAM を順に書き換え続ける）
+inline Program dashboard_demo_program() {
+  return {
+    {InstKind::LDI, Opcode::ADD, 1, 1, 0},        // 0: r1 = 1
+    {InstKind::LDI, Opcode::ADD, 3, 0, 0},        // 1: r3 = 0
+    {InstKind::ALU, Opcode::ADD, 2, 1, 2},        // 2: r2 = r2 + r1
+    {InstKind::ADI, Opcode::ADD, 3, 1, 0},        // 3: r3 += 1
+    {InstKind::APD, Opcode::ADD, 3, 0, 1},        // 4: ap1 = r3 + r0
+    {InstKind::MST, Opcode::ADD, 2, 1, 0},        // 5: [ap1 + 0] = r2
+    {InstKind::BRH, Opcode::ADD, static_cast<uint8_t>(Cond::NZ), 0, 0, 2}, // 6: r3 != 0 なら 2 へ
+    {InstKind::ADI, Opcode::ADD, 4, 1, 0},        // 7: r4 += 1
+    {InstKind::PST, Opcode::ADD, 4, 0, 0},        // 8: port[ap0 + 0] = r4
+    {InstKind::JMP, Opcode::ADD, 0, 0, 0, 2},     // 9: 2 へ
+  };
+}
+
+// ベンチマーク用のゲストプログラム（read_rom の書式。check は HLT 後の状態で結果を確かめる）
+struct GuestProgram {
+  const char *name;
+  const char *source;
+  std::function<bool(const CPU<CPUConfig::Fast> &)> check;
+};
+
+inline std::vector<GuestProgram> guest_programs() {
+  return {
+    {"sort", R"(; RAM[0..31] を埋めてバブルソート
+API ap1, 0
+LDI r1, 11        ;  1: 値
+LDI r2, 0         ;  2: 添字
+APD r2, r0, ap1   ;  3: ap1 = r2
+MST r1, ap1, 0
+ADI r1, 37
+ADI r2, 1
+CMI r2, 32
+BRH NZ, 3
+LDI r3, 31        ;  9: 未整列の末尾
+LDI r2, 0         ; 10
+APD r2, r0, ap1   ; 11
+MLD r4, ap1, 0
+MLD r5, ap1, 1
+CMP r5, r4        ; 14: a[i+1] >= a[i] なら交換しない
+BRH C, 18
+MST r5, ap1, 0
+MST r4, ap1, 1
+ADI r2, 1         ; 18
+CMP r2, r3
+BRH NZ, 11
+SBI r3, 1
+BRH NZ, 10
+HLT
+)", [](const CPU<CPUConfig::Fast> &cpu) { return std::is_sorted(cpu.ram.begin(), cpu.ram.begin() + 32) && cpu.ram[0] != cpu.ram[31]; }},
+    {"crc8", R"(; RAM[0..63] = 0..63 の CRC-8（多項式 0x07）を port 0 へ
+API ap1, 0
+LDI r2, 0
+APD r2, r0, ap1   ;  2
+MST r2, ap1, 0
+ADI r2, 1
+CMI r2, 64
+BRH NZ, 2
+LDI r1, 0         ;  7: crc
+LDI r2, 0
+APD r2, r0, ap1   ;  9
+MLD r3, ap1, 0
+XOR r1, r3, r1
+LDI r4, 8
+ADD r1, r1, r5    ; 13: 左シフト（最上位ビットがキャリーに出る）
+BRH NC, 17
+LDI r6, 7
+XOR r5, r6, r5
+MOV r5, r1        ; 17
+SBI r4, 1
+BRH NZ, 13
+ADI r2, 1
+CMI r2, 64
+BRH NZ, 9
+API ap2, 0
+PST r1, ap2, 0
+HLT
+)", [](const CPU<CPUConfig::Fast> &cpu) {
+      uint8_t crc = 0;
+      for (int i = 0; i < 64; ++i) {
+        crc ^= static_cast<uint8_t>(i);
+        for (int bit = 0; bit < 8; ++bit) {
+          crc = static_cast<uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+        }
+      }
+      return cpu.out_ports[0] == crc;
+    }},
+    {"popcount", R"(; 0〜255 の立っているビット数の合計（x &= x - 1 で数える）を port 0 / 1 へ
+LDI r1, 0
+LDI r7, 0         ;  1: 合計の下位
+LDI r8, 0         ;  2: 合計の上位
+MOV r1, r2        ;  3
+CMI r2, 0         ;  4
+BRH Z, 13
+MOV r2, r3
+SBI r3, 1
+AND r2, r3, r2
+ADI r7, 1
+BRH NC, 4
+ADI r8, 1
+JMP 4
+ADI r1, 1         ; 13
+BRH NZ, 3
+API ap1, 0
+PST r7, ap1, 0
+PST r8, ap1, 1
+HLT
+)", [](const CPU<CPUConfig::Fast> &cpu) { return cpu.out_ports[0] == 0 && cpu.out_ports[1] == 4; }},
+    {"io_loop", R"(; port 0 を256回読み、累積値を port 1 へ書き続ける
+API ap1, 0
+LDI r2, 0
+LDI r3, 0
+PLD r1, ap1, 0    ;  3
+ADD r3, r1, r3
+XOR r3, r2, r3
+PST r3, ap1, 1
+ADI r2, 1
+BRH NZ, 3
+PST r3, ap1, 2
+HLT
+)", [](const CPU<CPUConfig::Fast> &cpu) {
+      uint8_t acc = 0;
+      for (int i = 0; i < 256; ++i) {
+        acc = static_cast<uint8_t>((acc + cpu.in_ports[0]) ^ i);
+      }
+      return cpu.out_ports[1] == acc && cpu.out_ports[2] == acc;
+    }},
+  };
+}
+
+// ROM 書き換え方式のデバッガ
+// ブレークポイントの位置を TRAP に置き換え、元の命令は再開時に1命令だけ戻して実行する
+template <typename CPUType>
+class Debugger {
+public:
+  using Condition = std::function<bool(const CPUType &)>;
+
+  enum class Stop { Breakpoint, Watchpoint, Halted, StepLimit };
+
+  struct Breakpoint {
+    Instruction original;
+    Condition condition; // 空なら無条件。TRAP に当たったときだけ評価する
+    uint64_t hits = 0;
+  };
+
+  Debugger(CPUType &cpu, Program rom) : cpu(cpu), rom(std::move(rom)) {}
+
+  void set_breakpoint(uint16_t addr, Condition condition = nullptr) {
+    if (addr >= rom.size()) {
+      std::cerr << "Error: Breakpoint address " << addr << " is outside ROM. Terminate." << std::endl;
+      exit(1);
+    }
+    auto it = breakpoints.find(addr);
+    if (it == breakpoints.end()) {
+      breakpoints[addr] = {rom[addr], std::move(condition)};
+      rom[addr] = Instruction{InstKind::TRAP};
+      forget_memo();
+    } else {
+      it->second.condition = std::move(condition);
+    }
+  }
+
+  void clear_breakpoint(uint16_t addr) {
+    auto it = breakpoints.find(addr);
+    if (it != breakpoints.end()) {
+      rom[addr] = it->second.original;
+      breakpoints.erase(it);
+      forget_memo();
+    }
+  }
+
+  const Breakpoint* breakpoint(uint16_t addr) const {
+    auto it = breakpoints.find(addr);
+    return it == breakpoints.end() ? nullptr : &it->second;
+  }
+
+  // 書き換え後の ROM（元の命令を見るときは breakpoint(addr)->original）
+  const Program &program() const { return rom; }
+
+  // kinds は WatchKind の組み合わせ（0 で解除）
+  void set_watchpoint(WatchSpace space, uint8_t addr, uint8_t kinds) {
+    WatchTable &table = space == WatchSpace::RAM ? cpu.ram_watch : cpu.port_watch;
+    size_t limit = space == WatchSpace::RAM ? CPUType::config::RAMSize : CPUType::config::PortCount;
+    if (addr >= limit) {
+      std::cerr << "Error: Watchpoint address " << +addr << " is out of range. Terminate." << std::endl;
+      exit(1);
+    }
+    table.clear(addr);
+    if (kinds != 0) {
+      table.set(addr, kinds);
+    }
+  }
+
+  // pc ごとの Z++ ソース行（コード生成器が出力する行番号表。0 は不明）
+  void set_source_lines(std::vector<uint32_t> lines) { source_lines = std::move(lines); }
+
+  const WatchHit &last_watch() const { return cpu.watch_hit; }
+
+  // 例: "write ram[0x10] at pc 5 (line 12): 0x03 -> 0x04"
+  std::string describe(const WatchHit &hit) const {
+    static constexpr char hex[] = "0123456789abcdef";
+    auto byte = [](uint8_t v) { return std::string("0x") + hex[v >> 4] + hex[v & 0xF]; };
+    std::string text = hit.kind == WatchKind::Read ? "read" : hit.kind == WatchKind::Write ? "write" : "change";
+    text += hit.space == WatchSpace::RAM ? " ram[" : " port[";
+    text += byte(hit.addr) + "] at pc " + std::to_string(hit.pc);
+    if (hit.pc < source_lines.size() && source_lines[hit.pc] != 0) {
+      text += " (line " + std::to_string(source_lines[hit.pc]) + ")";
+    }
+    text += ": " + byte(hit.old_value);
+    if (hit.kind != WatchKind::Read) {
+      text += " -> " + byte(hit.new_value);
+    }
+    return text;
+  }
+
+  // 条件を満たすブレークポイント・HLT・命令数の上限のいずれかまで実行
+  Stop run(uint64_t max_steps) {
+    uint64_t steps = 0;
+    if (resume_pending && steps < max_steps) {
+      step_over();
+      ++steps;
+    }
+    while (steps < max_steps) {
+      steps += cpu.run(rom, max_steps - steps);
+      if (cpu.watch_stop) {
+        cpu.watch_stop = false;
+        cpu.halted = false;
+        return Stop::Watchpoint;
+      }
+      if (!cpu.trapped) {
+        return cpu.halted ? Stop::Halted : Stop::StepLimit;
+      }
+      // TRAP 自体は命令として数えない
+      cpu.halted = false;
+      cpu.trapped = false;
+      --steps;
+
+      Breakpoint &bp = breakpoints.at(cpu.pc);
+      if (!bp.condition || bp.condition(cpu)) {
+        ++bp.hits;
+        resume_pending = true;
+        return Stop::Breakpoint;
+      }
+      step_over();
+      ++steps;
+    }
+    return Stop::StepLimit;
+  }
+
+private:
+  CPUType &cpu;
+  Program rom;
+  std::vector<uint32_t> source_lines;
+  std::map<uint16_t, Breakpoint> breakpoints;
+  bool resume_pending = false; // ブレークポイントで停止中（次の run で元の命令から再開）
+
+  // ROM を書き換えたら、書き換え前の ROM で求めた純粋性の解析と記録した結果を捨てる
+  // （残っていると、ブレークポイントを含む呼び出しがメモ化されたまま TRAP を通らずに済んでしまう）
+  void forget_memo() {
+    if (cpu.memo) {
+      cpu.memo->clear();
+    }
+  }
+
+  // 元の命令を戻して1命令実行し、TRAP を書き直す
+  // 戻している間に呼び出し先を解析させないよう、この1命令はメモ化なしで実行する
+  void step_over() {
+    resume_pending = false;
+    uint16_t addr = cpu.pc;
+    auto it = breakpoints.find(addr);
+    if (it == breakpoints.end()) {
+      cpu.step(rom);
+    } else {
+      auto *memo = cpu.memo;
+      cpu.memo = nullptr;
+      rom[addr] = it->second.original;
+      cpu.step(rom);
+      rom[addr] = Instruction{InstKind::TRAP};
+      cpu.memo = memo;
+    }
+  }
+};
+
+// 実行時に構成名から CPU<Config> を選択して f(Config{}) を呼ぶ
+template <typename F>
+bool with_config(const std::string &name, F &&f) {
+  if (name == CPUConfig::Demo::Name) {
+    f(CPUConfig::Demo{});
+  } else if (name == CPUConfig::Spec::Name) {
+    f(CPUConfig::Spec{});
+  } else if (name == CPUConfig::Fast::Name) {
+    f(CPUConfig::Fast{});
+  } else {
+    return false;
+  }
+  return true;
+}
+
+class Helper {
+public:
+  template <typename ALUType>
+  void alu_test(ALUType &alu, uint8_t A, uint8_t B, Opcode opcode, const std::string &operation_name) {
+    std::cout << "Executing " << operation_name << "..." << std::flush;
+    alu.execute(A, B, opcode);
+    std::cout << " Done.\n";
+    std::cout << "  -> result: " << +alu.result << " (0x" << std::hex
+              << std::setw(2) << std::setfill('0') << +alu.result << std::dec
+              << ")\n";
+    std::cout << "  -> flags: ";
+    alu.print_flags();
+    std::cout << "\n";
+  }
+
+  template <typename RegisterType>
+  void reg_write_test(RegisterType &reg, uint8_t addr, uint8_t data, const std::string &operation_name) {
+    std::cout << "Executing " << operation_name << "..." << std::flush;
+    reg.reg_write(addr, data);
+    std::cout << " Done.\n";
+  }
+
+  template <typename RegisterType>
+  void reg_read_test(RegisterType &reg, uint8_t addr_a, uint8_t addr_b, const std::string &operation_name) {
+    std::cout << "Executing " << operation_name << "..." << std::flush;
+    auto [value_a, value_b] = reg.reg_read(addr_a, addr_b);
+    std::cout << " Done.\n";
+    std::cout << "  -> read: r" << +addr_a << " = " << +value_a << ", "
+              << "r" << +addr_b << " = " << +value_b << "\n";
+  }
+
+  template <typename ALUType, typename RegisterType>
+  void combined_test(ALUType &alu, RegisterType &reg, uint8_t addr_a, uint8_t addr_b, uint8_t result_addr, Opcode opcode, const std::string &operation_name) {
+    std::cout << "Executing " << operation_name << "..." << std::flush;
+
+    // レジスタから値を読み出し
+    auto [val_a, val_b] = reg.reg_read(addr_a, addr_b);
+    // ALU演算を実行
+    alu.execute(val_a, val_b, opcode);
+    // 結果をレジスタに書き込み
+    reg.reg_write(result_addr, alu.result);
+    
+    std::cout << " Done.\n";
+    std::cout << "  -> operands: r" << +addr_a << "=" << +val_a << ", r" << +addr_b << "=" << +val_b << "\n";
+    std::cout << "  -> result: " << +alu.result << " (0x" << std::hex << std::setw(2)
+              << std::setfill('0') << +alu.result << std::dec << ") -> r" << +result_addr << "\n";
+    std::cout << "  -> flags: ";
+    alu.print_flags();
+    std::cout << "\n";
+  }
+  
+  void halt(double Time_sec) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(Time_sec));
+  }
+
+  // 検査1項目の結果を表示し、失敗を数える
+  bool expect(bool condition, const std::string &label) {
+    std::cout << "  " << label << ": " << (condition ? "ok" : "FAILED") << "\n";
+    if (!condition) {
+      ++failures;
+    }
+    return condition;
+  }
+
+  // テストスイートの最後に合否を表示する（failures_before はスイート開始時の failures）
+  bool finish(const std::string &suite, size_t failures_before) {
+    bool ok = failures == failures_before;
+    if (ok) {
+      std::cout << std::endl << Colors::GREEN << Colors::BOLD << "✓ " << suite << " tests completed." << Colors::RESET << std::endl;
+    } else {
+      std::cout << std::endl << Colors::YELLOW << Colors::BOLD << "✗ " << suite << " tests failed (" << failures - failures_before << " checks)." << Colors::RESET << std::endl;
+    }
+    return ok;
+  }
+
+  size_t failures = 0;
+};
+
+template <typename Config>
+bool ALU_TESTS(Helper &run) {
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== ALU TESTS ====" << Colors::RESET << std::endl;
+  size_t before = run.failures;
+  ALU<Config> alu;
+  auto expect = [&run, &alu](uint8_t result, uint8_t flags) {
+    run.expect(alu.result == result && alu.flags == flags, "expected " + std::to_string(result));
+  };
+  std::cout << std::endl;
+
+  std::cout << Colors::YELLOW << "--- Arithmetic Operations ---" << Colors::RESET << std::endl;
+  run.alu_test(alu, 100, 200, Opcode::ADD, "ADD (100 + 200)");
+  expect(44, Flags::C | Flags::NZ | Flags::E);
+  run.alu_test(alu, 100, 200, Opcode::ADC, "ADC (100 + 200 + 1)");
+  expect(45, Flags::C | Flags::NZ | Flags::O);
+  run.alu_test(alu, 1, 200, Opcode::SUB, "SUB (1 - 200)");
+  expect(57, Flags::NC | Flags::NZ | Flags::O);
+  run.alu_test(alu, 1, 200, Opcode::SBC, "SBC (1 - 200 - 1)");
+  expect(56, Flags::NC | Flags::NZ | Flags::E);
+
+  std::cout << std::endl << Colors::YELLOW << "--- Logic Operations ---" << Colors::RESET << std::endl;
+  run.alu_test(alu, 0b01110111, 0b00001111, Opcode::NOR, "NOR (~(0b01110111 | 0b00001111))");
+  expect(128, Flags::NC | Flags::NZ | Flags::E);
+  run.alu_test(alu, 0b10010010, 0b01111011, Opcode::AND, "AND (0b10010010 & 0b01111011)");
+  expect(18, Flags::NC | Flags::NZ | Flags::E);
+  run.alu_test(alu, 0b01100111, 0b00110011, Opcode::XOR, "XOR (0b01100111 ^ 0b00110011)");
+  expect(84, Flags::NC | Flags::NZ | Flags::E);
+  run.alu_test(alu, 0b10101010, 0b01010101, Opcode::RSH, "RSH ((0b10101010 | 0b01010101) >> 1)");
+  expect(127, Flags::NC | Flags::NZ | Flags::O);
+
+  return run.finish("ALU", before);
+}
+
+bool GATE_TESTS(Helper &run) {
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== GATE-LEVEL ALU TESTS ====" << Colors::RESET << std::endl;
+  size_t before = run.failures;
+  ALU<CPUConfig::Fast> alu;
+  GateALU gate_alu(CPUConfig::ALUGateDelay);
+
+  std::cout << Colors::YELLOW << "--- Propagation Delay (critical path) ---" << Colors::RESET << std::endl;
+  for (uint8_t op = 0; op < 8; ++op) {
+    std::cout << "  " << OpcodeNames[op] << ": " << gate_alu.op_delay(static_cast<Opcode>(op)) << "s\n";
+  }
+
+  std::cout << std::endl << Colors::YELLOW << "--- Gate-level vs Behavioral (all A, B, 64 vectors/word) ---" << Colors::RESET << std::endl;
+  uint8_t A[GateALU::Lanes];
+  uint8_t B[GateALU::Lanes];
+  Opcode opcodes[GateALU::Lanes];
+  for (uint8_t op = 0; op < 8; ++op) {
+    size_t mismatches = 0;
+    for (int a = 0; a < 256; ++a) {
+      for (int b_base = 0; b_base < 256; b_base += GateALU::Lanes) {
+        for (size_t k = 0; k < GateALU::Lanes; ++k) {
+          A[k] = static_cast<uint8_t>(a);
+          B[k] = static_cast<uint8_t>(b_base + k);
+          opcodes[k] = static_cast<Opcode>(op);
+        }
+        gate_alu.evaluate(A, B, opcodes, GateALU::Lanes);
+        for (size_t k = 0; k < GateALU::Lanes; ++k) {
+          alu.compute(A[k], B[k], opcodes[k]);
+          if (gate_alu.result[k] != alu.result || gate_alu.flags[k] != alu.flags) {
+            if (mismatches == 0) {
+              std::cout << "  mismatch " << OpcodeNames[op] << " A=" << +A[k] << " B=" << +B[k]
+                        << ": gate=" << +gate_alu.result[k] << "/0x" << std::hex << +gate_alu.flags[k]
+                        << ", behavioral=" << std::dec << +alu.result << "/0x" << std::hex << +alu.flags
+                        << std::dec << "\n";
+            }
+            ++mismatches;
+          }
+        }
+      }
+    }
+    run.expect(mismatches == 0, std::string(OpcodeNames[op]) + ": 65536 vectors, " + std::to_string(mismatches) + " mismatches");
+  }
+
+  return run.finish("Gate-level ALU", before);
+}
+
+bool MEMO_TESTS(Helper &run) {
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== MEMOIZATION TESTS ====" << Colors::RESET << std::endl;
+  size_t before = run.failures;
+  using CPUType = CPU<CPUConfig::Fast>;
+  auto brh = [](Cond cond, uint16_t addr) { return Instruction{InstKind::BRH, Opcode::ADD, static_cast<uint8_t>(cond), 0, 0, addr}; };
+  // popcount(0..255) を20周呼んで r6 に足し込む
+  Program rom = {
+    {InstKind::LDI, Opcode::ADD, 7, 20, 0},       // 0: r7 = 20
+    {InstKind::LDI, Opcode::ADD, 5, 0, 0},        // 1: r5 = 0
+    {InstKind::MOV, Opcode::ADD, 5, 1, 0},        // 2: r1 = r5
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 12},    // 3: r15 = popcount(r1)
+    {InstKind::ALU, Opcode::ADD, 6, 15, 6},       // 4: r6 += r15
+    {InstKind::ADI, Opcode::ADD, 5, 1, 0},        // 5: r5 += 1
+    brh(Cond::NZ, 2),                             // 6
+    {InstKind::SBI, Opcode::ADD, 7, 1, 0},        // 7: r7 -= 1
+    brh(Cond::NZ, 1),                             // 8
+    {InstKind::PST, Opcode::ADD, 6, 0, 0},        // 9: port[0] = r6
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 21},    // 10: 純粋でない呼び出し
+    {InstKind::HLT},                              // 11
+    {InstKind::LDI, Opcode::ADD, 15, 0, 0},       // 12: popcount: r15 = 0
+    {InstKind::CMI, Opcode::ADD, 1, 0, 0},        // 13: r1 - 0
+    brh(Cond::Z, 20),                             // 14
+    {InstKind::MOV, Opcode::ADD, 1, 2, 0},        // 15: r2 = r1
+    {InstKind::ANI, Opcode::ADD, 2, 1, 0},        // 16: r2 &= 1
+    {InstKind::ALU, Opcode::ADD, 15, 2, 15},      // 17: r15 += r2
+    {InstKind::ALU, Opcode::RSH, 1, 0, 1},        // 18: r1 = (r1 | r0) >> 1
+    {InstKind::JMP, Opcode::ADD, 0, 0, 0, 13},    // 19
+    {InstKind::RET},                              // 20
+    {InstKind::PLD, Opcode::ADD, 15, 0, 0},       // 21: 入力ポートを読むので純粋でない
+    {InstKind::RET},                              // 22
+  };
+
+  auto plain = std::make_unique<CPUType>();
+  auto memoized = std::make_unique<CPUType>();
+  Memoizer<CPUConfig::Fast> memo;
+  memoized->memo = &memo;
+  auto start = std::chrono::steady_clock::now();
+  plain->run(rom, 1 << 20);
+  double plain_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  start = std::chrono::steady_clock::now();
+  memoized->run(rom, 1 << 20);
+  double memo_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << "  hits " << memo.hits << ", misses " << memo.misses << ", impure calls " << memo.impure_calls
+            << ", " << std::fixed << std::setprecision(2) << plain_seconds * 1e3 << "ms -> " << memo_seconds * 1e3 << "ms" << std::defaultfloat << "\n";
+  run.expect(plain->halted && plain->fault == nullptr && plain->out_ports[0] == static_cast<uint8_t>(20 * 1024), "program result");
+  run.expect(plain->save() == memoized->save(), "same architectural state with and without memoization");
+  run.expect(plain->retired == memoized->retired, "recorded instruction counts charged on hits");
+  run.expect(memo.hits + memo.misses == 20 * 256 && memo.hits >= 18 * 256, "hits after the first pass (direct-mapped table may evict a few)");
+  run.expect(memo.impure_calls == 1, "port-reading subroutine not memoized");
+
+  std::cout << Colors::YELLOW << "--- Table lookup (MLD) ---" << Colors::RESET << std::endl;
+  // r15 = ram[r1] を引く関数。関係ないアドレスへの MST では結果が残り、表へ書くと捨てられる
+  Program lookup = {
+    {InstKind::LDI, Opcode::ADD, 5, 7, 0},        // 0: r5 = 7
+    {InstKind::MST, Opcode::ADD, 5, 0, 3},        // 1: ram[3] = 7
+    {InstKind::LDI, Opcode::ADD, 1, 3, 0},        // 2: r1 = 3
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 14},    // 3: 外れ
+    {InstKind::MOV, Opcode::ADD, 15, 6, 0},       // 4: r6 = r15
+    {InstKind::MST, Opcode::ADD, 5, 0, 4},        // 5: ram[4] = 7（読んでいないアドレス）
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 14},    // 6: ヒット
+    {InstKind::ALU, Opcode::ADD, 6, 15, 6},       // 7: r6 += r15
+    {InstKind::LDI, Opcode::ADD, 5, 9, 0},        // 8: r5 = 9
+    {InstKind::MST, Opcode::ADD, 5, 0, 3},        // 9: ram[3] = 9（読んだアドレス）
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 14},    // 10: 捨てられたので外れ
+    {InstKind::ALU, Opcode::ADD, 6, 15, 6},       // 11: r6 += r15
+    {InstKind::PST, Opcode::ADD, 6, 0, 0},        // 12: port[0] = r6
+    {InstKind::HLT},                              // 13
+    {InstKind::APD, Opcode::ADD, 1, 0, 2},        // 14: ap2 = r1
+    {InstKind::MLD, Opcode::ADD, 15, 2, 0},       // 15: r15 = [ap2 + 0]
+    {InstKind::RET},                              // 16
+  };
+  Memoizer<CPUConfig::Fast> lookup_memo;
+  auto lookup_plain = std::make_unique<CPUType>();
+  auto lookup_cpu = std::make_unique<CPUType>();
+  lookup_cpu->memo = &lookup_memo;
+  lookup_plain->run(lookup, 1000);
+  lookup_cpu->run(lookup, 1000);
+  const auto *lookup_summary = lookup_memo.summary(lookup, 14);
+  run.expect(lookup_summary && lookup_summary->reads_ram && (lookup_summary->writes >> (32 + 2)) & 1, "read-only lookup is pure: reads RAM, writes ap2");
+  run.expect(lookup_memo.hits == 1 && lookup_memo.misses == 2, "hit after an unrelated store");
+  run.expect(lookup_memo.invalidated == 1, "store to the table invalidates the entry");
+  run.expect(lookup_cpu->out_ports[0] == 7 + 7 + 9 && lookup_plain->save() == lookup_cpu->save(), "same state as without memoization (ap2 written back on the hit)");
+
+  // 呼び出し元で設定したアドレスレジスタ (ap10) をそのまま使う表引きは、ap10 の値もキーになる
+  Program window = {
+    {InstKind::API, Opcode::ADD, 10, 0x20, 0},    // 0: ap10 = 0x20
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 7},     // 1: 外れ
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 7},     // 2: ヒット
+    {InstKind::API, Opcode::ADD, 10, 0x30, 0},    // 3: ap10 = 0x30
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 7},     // 4: 引数は同じだが ap10 が違うので外れ
+    {InstKind::PST, Opcode::ADD, 15, 0, 0},       // 5: port[0] = r15
+    {InstKind::HLT},                              // 6
+    {InstKind::MLD, Opcode::ADD, 15, 10, 1},      // 7: r15 = [ap10 + 1]
+    {InstKind::RET},                              // 8
+  };
+  Memoizer<CPUConfig::Fast> window_memo;
+  auto window_cpu = std::make_unique<CPUType>();
+  window_cpu->memo = &window_memo;
+  window_cpu->ram[0x21] = 5;
+  window_cpu->ram[0x31] = 6;
+  window_cpu->run(window, 1000);
+  const auto *window_summary = window_memo.summary(window, 7);
+  run.expect(window_summary && window_summary->ap_reads == (1u << 10), "caller's ap10 is part of the key");
+  run.expect(window_memo.hits == 1 && window_memo.misses == 2 && window_cpu->out_ports[0] == 6, "different ap10 misses");
+
+  std::cout << Colors::YELLOW << "--- Callee-saved registers ---" << Colors::RESET << std::endl;
+  // r5 を PSH / POP で退避して使う関数を同じ引数で2回呼ぶ
+  Program saving = {
+    {InstKind::LDI, Opcode::ADD, 5, 77, 0},       // 0: r5 = 77
+    {InstKind::LDI, Opcode::ADD, 1, 3, 0},        // 1: r1 = 3
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 6},     // 2
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 6},     // 3: 2回目はヒット
+    {InstKind::PST, Opcode::ADD, 5, 0, 0},        // 4: port[0] = r5
+    {InstKind::HLT},                              // 5
+    {InstKind::PSH, Opcode::ADD, 5, 0, 0},        // 6: r5 を退避
+    {InstKind::MOV, Opcode::ADD, 1, 5, 0},        // 7: r5 = r1
+    {InstKind::ALU, Opcode::ADD, 5, 5, 15},       // 8: r15 = r5 + r5
+    {InstKind::POP, Opcode::ADD, 5, 0, 0},        // 9: r5 を戻す
+    {InstKind::RET},                              // 10
+  };
+  Memoizer<CPUConfig::Fast> saving_memo;
+  const auto *summary = saving_memo.summary(saving, 6);
+  run.expect(summary && (summary->writes >> 15) & 1 && !((summary->writes >> 5) & 1), "PSH/POP pair is neutral: pure, writes r15 but not r5");
+  auto saving_cpu = std::make_unique<CPUType>();
+  saving_cpu->memo = &saving_memo;
+  Debugger<CPUType> debugger(*saving_cpu, saving);
+  run.expect(debugger.run(1000) == Debugger<CPUType>::Stop::Halted && saving_memo.hits == 1, "second call hits");
+  run.expect(saving_cpu->out_ports[0] == 77 && saving_cpu->regs.reg_read(15) == 6, "r5 restored, r15 = 6");
+
+  std::cout << Colors::YELLOW << "--- Breakpoint inside a memoized callee ---" << Colors::RESET << std::endl;
+  saving_cpu->reset();
+  debugger.set_breakpoint(8);
+  auto stop = debugger.run(1000);
+  run.expect(stop == Debugger<CPUType>::Stop::Breakpoint && saving_cpu->pc == 8, "first call stops (cached result discarded)");
+  stop = debugger.run(1000);
+  run.expect(stop == Debugger<CPUType>::Stop::Breakpoint && saving_cpu->pc == 8, "second call stops too");
+  run.expect(debugger.run(1000) == Debugger<CPUType>::Stop::Halted && saving_cpu->out_ports[0] == 77, "runs to HLT");
+
+  return run.finish("Memoization", before);
+}
+
+bool SUPEROPT_TESTS(Helper &run) {
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== SUPEROPTIMIZER TESTS ====" << Colors::RESET << std::endl;
+  size_t before = run.failures;
+  const Superoptimizer::Target *mul3 = nullptr;
+  auto targets = Superoptimizer::builtin_targets();
+  for (const auto &target : targets) {
+    if (target.name == "mul3") mul3 = &target;
+  }
+
+  std::cout << Colors::YELLOW << "--- Default test vectors ---" << Colors::RESET << std::endl;
+  auto result = Superoptimizer(1).search(*mul3, 2);
+  run.expect(!result.sequences.empty() && result.sequences.front().size() == 2, "mul3 in 2 instructions");
+  run.expect(std::all_of(result.sequences.begin(), result.sequences.end(),
+                         [&](const Program &p) { return Superoptimizer::verify(p, mul3->f); }), "every result is correct on all inputs");
+
+  std::cout << Colors::YELLOW << "--- States equal on every test vector ---" << Colors::RESET << std::endl;
+  // ベクタがすべて 0 なら r2 = x + x は r2 = 0 とベクタ上で区別できない。
+  // 途中状態をベクタだけで比べると x + x の側が刈られて mul3 が見つからない
+  std::array<uint8_t, Superoptimizer::Vectors> zeros{};
+  auto collided = Superoptimizer(2, zeros).search(*mul3, 2);
+  run.expect(!collided.sequences.empty() && collided.sequences.front().size() == 2, "mul3 still found in 2 instructions");
+  auto text = [](const std::vector<Program> &sequences) {
+    std::string out;
+    for (const Program &p : sequences) {
+      for (const Instruction &inst : p) out += disassemble(inst) + "; ";
+      out += "\n";
+    }
+    return out;
+  };
+  run.expect(text(collided.sequences) == text(result.sequences), "same sequences as with the default vectors");
+
+  return run.finish("Superoptimizer", before);
+}
+
+bool BRANCH_PROFILE_TESTS(Helper &run) {
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== BRANCH PROFILE TESTS ====" << Colors::RESET << std::endl;
+  size_t before = run.failures;
+  Program rom = sweep_demo_program();
+
+  std::cout << Colors::YELLOW << "--- Single run (a = 3, b = 5) ---" << Colors::RESET << std::endl;
+  auto cpu = std::make_unique<CPU<CPUConfig::Fast>>();
+  auto single = std::make_unique<BranchProfile>();
+  cpu->branches = single.get();
+  cpu->in_ports[0] = 3;
+  cpu->in_ports[1] = 5;
+  cpu->run(rom, 10000);
+  single->print(rom, {});
+  run.expect(single->counts[5].taken == 255 && single->counts[5].not_taken == 1, "_start loop: 255 taken, 1 not taken");
+  run.expect(single->counts[13].taken == 1 && single->counts[13].not_taken == 0, "a < b takes the branch");
+  run.expect(single->flushes() == 256, "flushes = taken branches");
+
+  std::cout << Colors::YELLOW << "--- Input sweep ---" << Colors::RESET << std::endl;
+  InputSweep<CPUConfig::Fast> sweep(rom, {0, 1});
+  std::vector<std::string> locations(14);
+  locations[13] = "sweep.zpp:5:5#0/F";
+  BranchProfile serial = sweep.profile(0, sweep.space(), 1);
+  BranchProfile parallel = sweep.profile(0, sweep.space(), std::max(2u, std::thread::hardware_concurrency()));
+  parallel.print(rom, locations);
+  // a < b は 65536 通りのうち (65536 - 256) / 2 通り
+  run.expect(parallel.counts[13].taken == 32640 && parallel.counts[13].not_taken == 32896, "a < b in 32640 of 65536 cases");
+  run.expect(parallel.counts[5].taken + parallel.counts[5].not_taken == 0, "_start is not profiled per case");
+  bool same = true;
+  for (size_t pc = 0; pc < serial.counts.size(); ++pc) {
+    same = same && serial.counts[pc].taken == parallel.counts[pc].taken && serial.counts[pc].not_taken == parallel.counts[pc].not_taken;
+  }
+  run.expect(same, "1 and N threads agree");
+  std::string json = parallel.to_json(rom, locations).value_or("");
+  run.expect(json.find("\"sweep.zpp:5:5#0/F\": { \"taken\": 32640, \"not_taken\": 32896 }") != std::string::npos, "JSON keyed by source location");
+  // 既存の profile.json の "calls" は残し、古い "branches" だけを置き換える
+  std::string merged = parallel.to_json(rom, locations, "{\n  \"calls\": { \"main.zpp:12:5\": 1800 },\n  \"branches\": { \"pc:1\": { \"taken\": 1, \"not_taken\": 0 } },\n  \"ram\": { \"buf\": [1, \"}\"] }\n}\n").value_or("");
+  run.expect(merged.find("\"calls\": { \"main.zpp:12:5\": 1800 }") != std::string::npos && merged.find("\"ram\": { \"buf\": [1, \"}\"] }") != std::string::npos, "other profile.json keys kept");
+  run.expect(merged.find("pc:1") == std::string::npos && merged.find("\"sweep.zpp:5:5#0/F\"") != std::string::npos, "old branches replaced");
+  std::string added = parallel.to_json(rom, locations, "{ \"calls\": {} }").value_or("");
+  run.expect(added.find("\"calls\": {},\n  \"branches\": {") != std::string::npos, "branches appended when missing");
+  run.expect(!parallel.to_json(rom, locations, "{ \"calls\": ").has_value(), "truncated profile.json rejected");
+
+  std::cout << Colors::YELLOW << "--- Branches inside a memoized callee ---" << Colors::RESET << std::endl;
+  // 純粋な f(r1) = (r1 != 0) を同じ引数で2回呼ぶ
+  Program calls = {
+    {InstKind::LDI, Opcode::ADD, 1, 3, 0},                                  // 0: r1 = 3
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 5},                               // 1: f(3)
+    {InstKind::CAL, Opcode::ADD, 0, 0, 0, 5},                               // 2: f(3)（メモ化なら省略）
+    {InstKind::PST, Opcode::ADD, 15, 0, 0},                                 // 3: port[0] = r15
+    {InstKind::HLT},                                                        // 4
+    {InstKind::LDI, Opcode::ADD, 15, 0, 0},                                 // 5: f: r15 = 0
+    {InstKind::CMI, Opcode::ADD, 1, 0, 0},                                  // 6: r1 - 0
+    {InstKind::BRH, Opcode::ADD, static_cast<uint8_t>(Cond::Z), 0, 0, 9},  // 7: r1 == 0 なら 9 へ
+    {InstKind::LDI, Opcode::ADD, 15, 1, 0},                                 // 8: r15 = 1
+    {InstKind::RET},                                                        // 9
+  };
+  Memoizer<CPUConfig::Fast> memo;
+  auto memoized = std::make_unique<CPU<CPUConfig::Fast>>();
+  memoized->memo = &memo;
+  memoized->run(calls, 1000);
+  run.expect(memo.hits == 1, "second call is a memo hit without profiling");
+  memo.clear();
+  auto profiled = std::make_unique<CPU<CPUConfig::Fast>>();
+  auto callee = std::make_unique<BranchProfile>();
+  profiled->memo = &memo;
+  profiled->branches = callee.get();
+  profiled->run(calls, 1000);
+  run.expect(memo.hits == 1 && profiled->out_ports[0] == 1, "profiling bypasses the memo");
+  run.expect(callee->counts[7].not_taken == 2, "callee BRH counted on both calls");
+
+  return run.finish("Branch profile", before);
+}
+
+bool SWEEP_TESTS(Helper &run) {
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== INPUT SWEEP TESTS ====" << Colors::RESET << std::endl;
+  size_t before = run.failures;
+  Program rom = sweep_demo_program();
+  InputSweep<CPUConfig::Fast> sweep(rom, {0, 1});
+  std::cout << "  snapshot after _start: " << sweep.startup_steps() << " steps skipped per case\n";
+  std::cout << "  case 0x1234: " << sweep.format_line(0x1234, sweep_demo_reference(sweep.inputs_of(0x1234))) << "\n";
+
+  auto start = std::chrono::steady_clock::now();
+  auto mismatches = sweep.run(0, sweep.space(), std::max(1u, std::thread::hardware_concurrency()), sweep_demo_reference);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "  " << sweep.space() << " cases in " << std::fixed << std::setprecision(3) << elapsed << "s" << std::defaultfloat << "\n";
+
+  if (!run.expect(mismatches.empty(), std::to_string(mismatches.size()) + " mismatches against the reference")) {
+    const auto &m = mismatches.front();
+    std::cout << "  first: expected " << sweep.format_line(m.index, m.expected) << ", got " << sweep.format_line(m.index, m.actual) << "\n";
+  }
+
+  std::cout << Colors::YELLOW << "--- Cases that do not reach HLT ---" << Colors::RESET << std::endl;
+  // port[0] = 入力 を出力した後、入力 0 では止まらず、入力 1 では CALstack が空のまま RET する
+  Program stuck = {
+    {InstKind::PLD, Opcode::ADD, 1, 0, 0},                                  // 0: r1 = port[0]
+    {InstKind::PST, Opcode::ADD, 1, 0, 0},                                  // 1: port[0] = r1
+    {InstKind::CMI, Opcode::ADD, 1, 0, 0},                                  // 2: r1 - 0
+    {InstKind::BRH, Opcode::ADD, static_cast<uint8_t>(Cond::Z), 0, 0, 7},  // 3: r1 == 0 なら 7 へ
+    {InstKind::CMI, Opcode::ADD, 1, 1, 0},                                  // 4: r1 - 1
+    {InstKind::BRH, Opcode::ADD, static_cast<uint8_t>(Cond::Z), 0, 0, 8},  // 5: r1 == 1 なら 8 へ
+    {InstKind::HLT},                                                        // 6
+    {InstKind::JMP, Opcode::ADD, 0, 0, 0, 7},                               // 7: 無限ループ
+    {InstKind::RET},                                                        // 8: CALstack underflow
+  };
+  InputSweep<CPUConfig::Fast> stuck_sweep(stuck, {0}, 1000);
+  auto stuck_mismatches = stuck_sweep.run(0, stuck_sweep.space(), 2, [](const std::vector<uint8_t> &in) { return OutputTrace{{0, in[0]}}; });
+  for (const auto &m : stuck_mismatches) {
+    std::cout << "    " << stuck_sweep.format_line(m.index, m.actual) << "\n";
+  }
+  run.expect(stuck_mismatches.size() == 2, "2 mismatches although every output matches");
+  run.expect(stuck_mismatches.size() == 2 && stuck_mismatches[0].index == 0 && stuck_mismatches[0].actual.stopped.find("no HLT") == 0, "step limit reported");
+  run.expect(stuck_mismatches.size() == 2 && stuck_mismatches[1].index == 1 && stuck_mismatches[1].actual.stopped == "fault: CALstack underflow", "fault reported");
+
+  std::cout << Colors::YELLOW << "--- ROM file (--rom) ---" << Colors::RESET << std::endl;
+  // disassemble の出力をそのまま読み戻せる
+  std::string path = (std::filesystem::temp_directory_path() / "cpuvm_sweep_test.rom").string();
+  {
+    std::ofstream out(path);
+    out << "; sweep_demo_program\n\n";
+    for (const Instruction &inst : rom) {
+      out << disassemble(inst) << "\n";
+    }
+  }
+  Program loaded = read_rom(path);
+  std::filesystem::remove(path);
+  bool same = loaded.size() == rom.size();
+  for (size_t pc = 0; same && pc < rom.size(); ++pc) {
+    same = disassemble(loaded[pc]) == disassemble(rom[pc]);
+  }
+  run.expect(same, std::to_string(loaded.size()) + " instructions read back");
+  InputSweep<CPUConfig::Fast> loaded_sweep(loaded, {0, 1});
+  run.expect(loaded_sweep.run(0, 4096, 2, sweep_demo_reference).empty(), "loaded program matches the reference");
+
+  return run.finish("Input sweep", before);
+}
+
+bool MULTICORE_TESTS(Helper &run) {
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== MULTI-CORE TESTS ====" << Colors::RESET << std::endl;
+  size_t before = run.failures;
+  using Config = CPUConfig::Fast;
+  Program rom = multicore_demo_program();
+
+  MultiCore<Config> single(rom, {1, 16, 2, 1});
+  single.run(1000);
+  run.expect(single.all_halted() && single.ram[0] == 100, "1 core counts to 100");
+
+  // 同じ設定ならホストのスレッド数によらず同じ結果（競合による取りこぼしも再現する）
+  MultiCore<Config> serial(rom, {4, 16, 2, 1});
+  MultiCore<Config> parallel(rom, {4, 16, 2, 4});
+  serial.run(1000);
+  parallel.run(1000);
+  std::cout << "  4 cores: ram[0] = " << +serial.ram[0] << " (lost updates: " << 400 - serial.ram[0] << ")\n";
+  run.expect(serial.hash == parallel.hash && serial.ram == parallel.ram, "1 and 4 host threads agree");
+  run.expect(serial.stats[0].conflicts + serial.stats[1].conflicts + serial.stats[2].conflicts + serial.stats[3].conflicts > 0, "contention on ram[0] reported");
+  serial.print_report();
+
+  return run.finish("Multi-core", before);
+}
+
+bool DEBUGGER_TESTS(Helper &run) {
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== DEBUGGER TESTS ====" << Colors::RESET << std::endl;
+  size_t before = run.failures;
+  using CPUType = CPU<CPUConfig::Fast>;
+  auto cpu = std::make_unique<CPUType>();
+  // r1 を 0 から 10 まで数えて HLT
+  Program rom = {
+    {InstKind::LDI, Opcode::ADD, 1, 0, 0},                                  // 0: r1 = 0
+    {InstKind::ADI, Opcode::ADD, 1, 1, 0},                                  // 1: r1 += 1
+    {InstKind::CMI, Opcode::ADD, 1, 10, 0},                                 // 2: r1 - 10
+    {InstKind::BRH, Opcode::ADD, static_cast<uint8_t>(Cond::NZ), 0, 0, 1}, // 3: r1 != 10 なら 1 へ
+    {InstKind::HLT},                                                        // 4
+  };
+  Debugger<CPUType> debugger(*cpu, rom);
+
+  std::cout << Colors::YELLOW << "--- Unconditional breakpoint ---" << Colors::RESET << std::endl;
+  debugger.set_breakpoint(2);
+  run.expect(debugger.program()[2].kind == InstKind::TRAP, "ROM patched with TRAP");
+  auto stop = debugger.run(1000);
+  run.expect(stop == Debugger<CPUType>::Stop::Breakpoint && cpu->pc == 2 && cpu->regs.reg_read(1) == 1, "stops at pc 2 with r1 = 1");
+  stop = debugger.run(1000);
+  run.expect(stop == Debugger<CPUType>::Stop::Breakpoint && cpu->regs.reg_read(1) == 2, "resumes and stops again with r1 = 2");
+
+  std::cout << Colors::YELLOW << "--- Conditional breakpoint ---" << Colors::RESET << std::endl;
+  debugger.set_breakpoint(2, [](const CPUType &c) { return c.regs.dump()[1] == 7; });
+  stop = debugger.run(1000);
+  run.expect(stop == Debugger<CPUType>::Stop::Breakpoint && cpu->regs.reg_read(1) == 7, "stops only when r1 == 7");
+  run.expect(debugger.breakpoint(2)->hits == 3, "hit count");
+
+  std::cout << Colors::YELLOW << "--- Clear and run to HLT ---" << Colors::RESET << std::endl;
+  debugger.clear_breakpoint(2);
+  run.expect(debugger.program()[2].kind == InstKind::CMI, "original instruction restored");
+  stop = debugger.run(1000);
+  run.expect(stop == Debugger<CPUType>::Stop::Halted && cpu->regs.reg_read(1) == 10 && !cpu->trapped, "halts with r1 = 10");
+  run.expect(cpu->retired == 1 + 10 * 3 + 1, "TRAP not counted as an instruction");
+
+  std::cout << Colors::YELLOW << "--- Watchpoints ---" << Colors::RESET << std::endl;
+  // r1 を ram[0x20] に書き続け、ram[0x20] と port 3 を読む
+  Program store_loop = {
+    {InstKind::API, Opcode::ADD, 1, 0x20, 0},                               // 0: ap1 = 0x20
+    {InstKind::ADI, Opcode::ADD, 1, 1, 0},                                  // 1: r1 += 1
+    {InstKind::ANI, Opcode::ADD, 1, 0x03, 0},                               // 2: r1 &= 3
+    {InstKind::MST, Opcode::ADD, 1, 1, 0},                                  // 3: [ap1 + 0] = r1
+    {InstKind::MLD, Opcode::ADD, 2, 1, 0},                                  // 4: r2 = [ap1 + 0]
+    {InstKind::PLD, Opcode::ADD, 3, 0, 3},                                  // 5: r3 = port[ap0 + 3]
+    {InstKind::JMP, Opcode::ADD, 0, 0, 0, 1},                               // 6: 1 へ
+  };
+  cpu->reset();
+  Debugger<CPUType> watcher(*cpu, store_loop);
+  watcher.set_source_lines({1, 2, 2, 3, 4, 5, 6});
+  watcher.set_watchpoint(WatchSpace::RAM, 0x20, WatchKind::Change);
+  stop = watcher.run(1000);
+  run.expect(stop == Debugger<CPUType>::Stop::Watchpoint && watcher.last_watch().pc == 3 && cpu->pc == 4, "change watch stops after MST");
+  std::cout << "    " << watcher.describe(watcher.last_watch()) << "\n";
+  stop = watcher.run(1000);
+  run.expect(stop == Debugger<CPUType>::Stop::Watchpoint && watcher.last_watch().old_value == 1 && watcher.last_watch().new_value == 2, "next change reports old and new values");
+  watcher.set_watchpoint(WatchSpace::RAM, 0x20, WatchKind::Read);
+  stop = watcher.run(1000);
+  run.expect(stop == Debugger<CPUType>::Stop::Watchpoint && watcher.last_watch().kind == WatchKind::Read && watcher.last_watch().pc == 4, "read watch on MLD");
+  watcher.set_watchpoint(WatchSpace::RAM, 0x20, 0);
+  watcher.set_watchpoint(WatchSpace::Port, 3, WatchKind::Read);
+  stop = watcher.run(1000);
+  run.expect(stop == Debugger<CPUType>::Stop::Watchpoint && watcher.last_watch().space == WatchSpace::Port && watcher.last_watch().pc == 5, "port watch on PLD");
+  std::cout << "    " << watcher.describe(watcher.last_watch()) << "\n";
+  watcher.set_watchpoint(WatchSpace::Port, 3, 0);
+  run.expect(watcher.run(1000) == Debugger<CPUType>::Stop::StepLimit, "no stop after clearing");
+
+  return run.finish("Debugger", before);
+}
+
+template <typename Config>
+bool REG_TESTS(Helper &run){
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== REGISTER TESTS ====" << Colors::RESET << std::endl;
+  size_t before = run.failures;
+  Register<Config> reg;
+  std::cout << std::endl;
+
+  std::cout << Colors::YELLOW << "--- Write Operations ---" << Colors::RESET << std::endl;
+  run.reg_write_test(reg, 1, 100, "Write 100 to r1");
+  run.reg_write_test(reg, 2, 200, "Write 200 to r2");
+  run.reg_write_test(reg, 0, 255, "Attempt write 255 to r0 (should be ignored)");
+  std::cout << std::endl;
+  reg.print_all_regs();
+
+  std::cout << std::endl << Colors::YELLOW << "--- Read Operations ---" << Colors::RESET << std::endl;
+  run.reg_read_test(reg, 1, 2, "Read from r1 and r2");
+  run.reg_read_test(reg, 0, 0, "Read from r0 twice");
+  run.reg_read_test(reg, 0, 1, "Read from r0 and r1");
+  run.expect(reg.reg_read(1) == 100 && reg.reg_read(2) == 200, "r1 = 100, r2 = 200");
+  run.expect(reg.reg_read(0) == 0, "r0 stays 0");
+
+  std::cout << std::endl << Colors::YELLOW << "--- Clear Operation ---" << Colors::RESET << std::endl;
+  reg.reg_clear();
+  reg.print_all_regs();
+  run.expect(reg.reg_read(1) == 0 && reg.reg_read(2) == 0, "cleared");
+
+  return run.finish("Register", before);
+}
+
+template <typename Config>
+bool COMBINED_TESTS(Helper &run) {
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== COMBINED ALU + REGISTER TESTS ====" << Colors::RESET << std::endl;
+  size_t before = run.failures;
+  ALU<Config> alu;
+  Register<Config> reg;
+  std::cout << std::endl;
+
+  std::cout << Colors::YELLOW << "--- Setup: Initialize registers ---" << Colors::RESET << std::endl;
+  // テスト用の初期値をレジスタに設定
+  std::cout << Colors::DIM << "Setting up test values..." << Colors::RESET << std::endl;
+  reg.reg_write(1, 150);  // r1 = 150
+  reg.reg_write(2, 100);  // r2 = 100
+  reg.reg_write(3, 50);   // r3 = 50
+  reg.reg_write(4, 255);  // r4 = 255
+
+  std::cout << std::endl << Colors::BOLD << "Initial register state:" << Colors::RESET << std::endl;
+  reg.print_all_regs();
+
+  std::cout << std::endl << Colors::YELLOW << "--- ALU + Register Operations ---" << Colors::RESET << std::endl;
+  // 組み合わせテストの実行
+  run.combined_test(alu, reg, 1, 2, 5, Opcode::ADD, "ADD r1+r2 -> r5 (150+100)");
+  std::cout << std::endl;
+  run.combined_test(alu, reg, 1, 3, 6, Opcode::SUB, "SUB r1-r3 -> r6 (150-50)");
+  std::cout << std::endl;
+  run.combined_test(alu, reg, 2, 4, 7, Opcode::AND, "AND r2&r4 -> r7 (100&255)");
+  std::cout << std::endl;
+  run.combined_test(alu, reg, 5, 6, 1, Opcode::XOR, "XOR r5^r6 -> r1 (result^result)");
+
+  std::cout << std::endl << Colors::BOLD << "Final register state:" << Colors::RESET << std::endl;
+  reg.print_all_regs();
+  run.expect(reg.reg_read(5) == 250 && reg.reg_read(6) == 100 && reg.reg_read(7) == 100, "r5 = 250, r6 = 100, r7 = 100");
+  run.expect(reg.reg_read(1) == (250 ^ 100), "r1 = r5 ^ r6");
+
+  return run.finish("Combined ALU+Register", before);
+}
+
+// ベンチマーク結果（1項目）
+struct BenchResult {
+  std::string name;
+  double ns_per_op;
+};
+
+volatile uint8_t bench_sink = 0; // 計測対象の計算が最適化で消えないようにする
+
+// ベンチマーク計測（Fast 構成で遅延なしに実行）
+class Bench {
+public:
+  std::vector<BenchResult> results;
+
+  // f() 1回で ops_per_call 回の操作を行う関数を計測し、1操作あたりの時間を記録
+  template <typename F>
+  void run(const std::string &name, uint64_t ops_per_call, F &&f) {
+    using Clock = std::chrono::steady_clock;
+    // 1サンプルが 20ms 以上になる呼び出し回数を求める
+    uint64_t calls = 1;
+    while (true) {
+      auto start = Clock::now();
+      for (uint64_t i = 0; i < calls; ++i) {
+        f();
+      }
+      double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+      if (elapsed >= 0.02 || calls >= (1ULL << 40)) {
+        break;
+      }
+      calls *= 2;
+    }
+    // 5サンプルの中央値
+    std::vector<double> samples;
+    for (int sample = 0; sample < 5; ++sample) {
+      auto start = Clock::now();
+      for (uint64_t i = 0; i < calls; ++i) {
+        f();
+      }
+      double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+      samples.push_back(elapsed / static_cast<double>(calls * ops_per_call));
+    }
+    std::sort(samples.begin(), samples.end());
+    results.push_back({name, samples[samples.size() / 2]});
+    std::cout << "  " << std::left << std::setw(32) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << results.back().ns_per_op << " ns/op" << std::defaultfloat << std::endl;
+  }
+
+  void write_json(const std::string &path) const {
+    std::ofstream out(path);
+    if (!out) {
+      std::cerr << "Error: Cannot write " << path << ". Terminate." << std::endl;
+      exit(1);
+    }
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+      out << "    {\"name\": \"" << results[i].name << "\", \"ns_per_op\": " << results[i].ns_per_op << "}"
+          << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+  }
+
+  // write_json() が出力した形式のみを読み込む（読めない・1件もないファイルは異常終了）
+  static std::vector<BenchResult> read_json(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+      std::cerr << "Error: Cannot read " << path << ". Terminate." << std::endl;
+      exit(1);
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+
+    auto malformed = [&path]() {
+      std::cerr << "Error: Malformed benchmark file " << path << ". Terminate." << std::endl;
+      exit(1);
+    };
+    std::vector<BenchResult> loaded;
+    size_t pos = 0;
+    while ((pos = text.find("\"name\": \"", pos)) != std::string::npos) {
+      pos += 9;
+      size_t name_end = text.find('"', pos);
+      size_t value_pos = text.find("\"ns_per_op\": ", name_end);
+      // 次の項目の値を拾わないように、値は同じ項目の中になければならない
+      if (name_end == std::string::npos || value_pos == std::string::npos || text.find("\"name\"", name_end) < value_pos) {
+        malformed();
+      }
+      double value = 0.0;
+      try {
+        value = std::stod(text.substr(value_pos + 13));
+      } catch (const std::exception &) {
+        malformed();
+      }
+      if (!std::isfinite(value) || value < 0.0) {
+        malformed();
+      }
+      loaded.push_back({text.substr(pos, name_end - pos), value});
+      pos = value_pos;
+    }
+    if (loaded.empty()) {
+      std::cerr << "Error: No benchmark results in " << path << ". Terminate." << std::endl;
+      exit(1);
+    }
+    return loaded;
+  }
+};
+
+void BENCHMARKS(Bench &bench) {
+  using Config = CPUConfig::Fast;
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== BENCHMARKS (config: " << Config::Name << ") ====" << Colors::RESET << std::endl;
+
+  std::cout << Colors::YELLOW << "--- Micro: ALU::execute ---" << Colors::RESET << std::endl;
+  ALU<Config> alu;
+  for (uint8_t op = 0; op < 8; ++op) {
+    Opcode opcode = static_cast<Opcode>(op);
+    bench.run(std::string("alu.execute/") + OpcodeNames[op], 256, [&alu, opcode] {
+      uint8_t acc = 0;
+      for (int i = 0; i < 256; ++i) {
+        alu.execute(static_cast<uint8_t>(i), static_cast<uint8_t>(i * 7 + acc), opcode);
+        acc ^= alu.result ^ alu.flags;
+      }
+      bench_sink = acc;
+    });
+  }
+
+  std::cout << std::endl << Colors::YELLOW << "--- Micro: GateALU::evaluate (per vector) ---" << Colors::RESET << std::endl;
+  GateALU gate_alu(CPUConfig::ALUGateDelay);
+  uint8_t A[GateALU::Lanes];
+  uint8_t B[GateALU::Lanes];
+  Opcode opcodes[GateALU::Lanes];
+  for (size_t k = 0; k < GateALU::Lanes; ++k) {
+    A[k] = static_cast<uint8_t>(k * 13);
+    B[k] = static_cast<uint8_t>(k * 29 + 5);
+    opcodes[k] = static_cast<Opcode>(k % 8);
+  }
+  bench.run("gate_alu.evaluate/mixed", GateALU::Lanes, [&] {
+    gate_alu.evaluate(A, B, opcodes, GateALU::Lanes);
+    bench_sink = gate_alu.result[0];
+  });
+
+  std::cout << std::endl << Colors::YELLOW << "--- Micro: Register ---" << Colors::RESET << std::endl;
+  Register<Config> reg;
+  bench.run("reg.reg_write", 256, [&reg] {
+    for (int i = 0; i < 256; ++i) {
+      reg.reg_write(static_cast<uint8_t>(i % Config::RegCount), static_cast<uint8_t>(i));
+    }
+    bench_sink = reg.reg_read(1);
+  });
+  bench.run("reg.reg_read/single", 256, [&reg] {
+    uint8_t acc = 0;
+    for (int i = 0; i < 256; ++i) {
+      acc ^= reg.reg_read(static_cast<uint8_t>(i % Config::RegCount));
+    }
+    bench_sink = acc;
+  });
+  bench.run("reg.reg_read/pair", 256, [&reg] {
+    uint8_t acc = 0;
+    for (int i = 0; i < 256; ++i) {
+      auto [a, b] = reg.reg_read(static_cast<uint8_t>(i % Config::RegCount), static_cast<uint8_t>((i + 3) % Config::RegCount));
+      acc ^= a ^ b;
+    }
+    bench_sink = acc;
+  });
+
+  std::cout << std::endl << Colors::YELLOW << "--- Decode ---" << Colors::RESET << std::endl;
+  // ゲストプログラム全体を命令単位で disassemble / read_rom する
+  std::vector<GuestProgram> guests = guest_programs();
+  Program corpus;
+  std::string corpus_text;
+  for (const GuestProgram &guest : guests) {
+    std::istringstream source(guest.source);
+    for (const Instruction &inst : read_rom(source, guest.name)) {
+      corpus.push_back(inst);
+      corpus_text += disassemble(inst) + "\n";
+    }
+  }
+  bench.run("decode.disassemble", corpus.size(), [&corpus] {
+    size_t length = 0;
+    for (const Instruction &inst : corpus) {
+      length += disassemble(inst).size();
+    }
+    bench_sink = static_cast<uint8_t>(length);
+  });
+  bench.run("decode.read_rom", corpus.size(), [&corpus_text] {
+    std::istringstream in(corpus_text);
+    bench_sink = static_cast<uint8_t>(read_rom(in, "corpus").size());
+  });
+
+  std::cout << std::endl << Colors::YELLOW << "--- Guest programs (CPU<Fast>::run, 1 op = 1 guest instruction) ---" << Colors::RESET << std::endl;
+  auto cpu = std::make_unique<CPU<Config>>();
+  cpu->in_ports[0] = 0x5A;
+  const CPUState<Config> initial = cpu->save();
+  for (const GuestProgram &guest : guests) {
+    std::istringstream source(guest.source);
+    Program rom = read_rom(source, guest.name);
+    cpu->restore(initial);
+    uint64_t instructions = cpu->run(rom, 1 << 24);
+    if (!cpu->halted || cpu->fault || !guest.check(*cpu)) {
+      std::cerr << "Error: Guest program " << guest.name << " gave a wrong result. Terminate." << std::endl;
+      exit(1);
+    }
+    bench.run(std::string("guest/") + guest.name, instructions, [&cpu, &rom, &initial] {
+      cpu->restore(initial);
+      bench_sink = static_cast<uint8_t>(cpu->run(rom, 1 << 24));
+    });
+    std::cout << "  " << std::setw(32) << "" << std::fixed << std::setprecision(1) << std::setw(10) << 1e3 / bench.results.back().ns_per_op
+              << " guest MIPS (" << instructions << " instructions)" << std::defaultfloat << std::endl;
+  }
+
+  std::cout << std::endl << Colors::YELLOW << "--- Macro ---" << Colors::RESET << std::endl;
+  // 読み出し → ALU → 書き戻し（COMBINED_TESTS と同じ経路）を全オペコードで回す
+  bench.run("macro/alu_register_loop", 1024, [&alu, &reg] {
+    for (int i = 0; i < 1024; ++i) {
+      uint8_t ra = static_cast<uint8_t>(1 + i % (Config::RegCount - 1));
+      uint8_t rb = static_cast<uint8_t>(1 + (i * 5) % (Config::RegCount - 1));
+      auto [a, b] = reg.reg_read(ra, rb);
+      alu.execute(a, static_cast<uint8_t>(b + i), static_cast<Opcode>(i & 0b111));
+      reg.reg_write(static_cast<uint8_t>(1 + (i * 3) % (Config::RegCount - 1)), alu.result);
+    }
+    bench_sink = reg.reg_read(1);
+  });
+  // ゲートレベルALUの全入力照合（GATE_TESTS と同じ処理, 1オペコード分）
+  bench.run("macro/gate_exhaustive_sweep", 65536, [&] {
+    uint8_t a_in[GateALU::Lanes];
+    uint8_t b_in[GateALU::Lanes];
+    Opcode ops[GateALU::Lanes];
+    size_t mismatches = 0;
+    for (int a = 0; a < 256; ++a) {
+      for (int b_base = 0; b_base < 256; b_base += GateALU::Lanes) {
+        for (size_t k = 0; k < GateALU::Lanes; ++k) {
+          a_in[k] = static_cast<uint8_t>(a);
+          b_in[k] = static_cast<uint8_t>(b_base + k);
+          ops[k] = Opcode::SUB;
+        }
+        gate_alu.evaluate(a_in, b_in, ops, GateALU::Lanes);
+        for (size_t k = 0; k < GateALU::Lanes; ++k) {
+          alu.compute(a_in[k], b_in[k], ops[k]);
+          mismatches += (gate_alu.result[k] != alu.result || gate_alu.flags[k] != alu.flags);
+        }
+      }
+    }
+    bench_sink = static_cast<uint8_t>(mismatches);
+  });
+}
+
+// 2回分の結果を比較し、しきい値（%）を超えて遅くなった項目と、新しい結果からなくなった項目の数を返す
+size_t COMPARE_BENCHMARKS(const std::string &old_path, const std::string &new_path, double threshold) {
+  std::vector<BenchResult> old_results = Bench::read_json(old_path);
+  std::vector<BenchResult> new_results = Bench::read_json(new_path);
+  std::cout << Colors::CYAN << Colors::BOLD << "\n==== BENCHMARK COMPARISON (threshold " << threshold << "%) ====" << Colors::RESET << std::endl;
+
+  size_t regressions = 0;
+  for (const BenchResult &now : new_results) {
+    auto before = std::find_if(old_results.begin(), old_results.end(), [&now](const BenchResult &r) { return r.name == now.name; });
+    if (before == old_results.end()) {
+      std::cout << "  " << std::left << std::setw(32) << now.name << std::right << Colors::DIM << "   (new)" << Colors::RESET << std::endl;
+      continue;
+    }
+    double change = (now.ns_per_op - before->ns_per_op) / before->ns_per_op * 100.0;
+    bool regressed = change > threshold;
+    regressions += regressed;
+    std::cout << "  " << std::left << std::setw(32) << now.name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << before->ns_per_op << " -> " << std::setw(10) << now.ns_per_op << " ns/op  "
+              << (regressed ? Colors::YELLOW : Colors::GREEN) << std::showpos << std::setw(8) << change << "%"
+              << std::noshowpos << (regressed ? "  REGRESSION" : "") << Colors::RESET << std::defaultfloat << std::endl;
+  }
+  // 計測されなくなった項目は、遅くなったかどうか確かめられないので失敗に数える
+  size_t removed = 0;
+  for (const BenchResult &before : old_results) {
+    if (std::none_of(new_results.begin(), new_results.end(), [&before](const BenchResult &r) { return r.name == before.name; })) {
+      std::cout << "  " << std::left << std::setw(32) << before.name << std::right << Colors::YELLOW << "   (removed)" << Colors::RESET << std::endl;
+      ++removed;
+    }
+  }
+
+  if (regressions == 0 && removed == 0) {
+    std::cout << std::endl << Colors::GREEN << Colors::BOLD << "✓ No regressions." << Colors::RESET << std::endl;
+  } else {
+    std::cout << std::endl << Colors::YELLOW << Colors::BOLD << "✗ " << regressions << " regression(s) over " << threshold << "%, "
+              << removed << " removed." << Colors::RESET << std::endl;
+  }
+  return regressions + removed;
+}
+
+// 実行中に入力ポートへ届く値（Input バッファの非同期更新）
+struct PortEvent {
+  uint32_t step;
+  uint8_t port;
+  uint8_t value;
+};
+
+// 差分ファジングのテストケース
+template <typename Config>
+struct FuzzCase {
+  Program program;
+  CPUState<Config> start;
+  std::vector<PortEvent> events; // step の昇順
+};
+
+// 全実行エンジンを同じスナップショットから同時に動かし、結果を突き合わせる
+// 参照 (CPU<Config>) 以外のエンジンは restore / set_input / advance / save / comparable で操作する
+template <typename Config>
+class DifferentialFuzzer {
+public:
+  // 参照と1命令ずつ同時に動かす CPU（ALU だけを差し替えたもの）
+  template <typename CPUType>
+  class LockstepEngine {
+  public:
+    void restore(const CPUState<Config> &state) { cpu.restore(state); }
+    void set_input(uint8_t port, uint8_t value) { cpu.in_ports[port] = value; }
+    void advance(const Program &program, const CPU<Config> &) { cpu.step(program); }
+    bool comparable(const CPU<Config> &, bool) const { return true; }
+    CPUState<Config> save() const { return cpu.save(); }
+
+  private:
+    CPUType cpu;
+  };
+
+  // CAL をメモ化する CPU。ヒットすると呼び出し先をまとめて飛ばすので、参照の retired に追いつくまで進め、
+  // 同じ命令数のときだけ比べる（途中で止まったら、その時点で比べる）
+  class MemoEngine {
+  public:
+    MemoEngine() { cpu.memo = &memo; }
+    void restore(const CPUState<Config> &state) { cpu.restore(state); }
+    void set_input(uint8_t port, uint8_t value) { cpu.in_ports[port] = value; }
+    void advance(const Program &program, const CPU<Config> &reference) {
+      if (reference.halted && !cpu.halted && cpu.retired == reference.retired) {
+        cpu.step(program); // 参照が異常停止した命令（retired は増えない）
+        return;
+      }
+      while (!cpu.halted && cpu.retired < reference.retired) {
+        cpu.step(program);
+      }
+    }
+    bool comparable(const CPU<Config> &reference, bool final) const {
+      return cpu.retired == reference.retired || cpu.halted || (final && reference.halted);
+    }
+    CPUState<Config> save() const { return cpu.save(); }
+
+  private:
+    CPU<Config> cpu;
+    Memoizer<Config> memo;
+  };
+
+  // 全命令に条件が常に偽のブレークポイントを置き、毎命令 TRAP -> 条件の評価 -> 元の命令の実行を通す
+  class TrapEngine {
+  public:
+    void restore(const CPUState<Config> &state) { cpu.restore(state); }
+    void set_input(uint8_t port, uint8_t value) { cpu.in_ports[port] = value; }
+    void advance(const Program &program, const CPU<Config> &) {
+      if (!debugger) {
+        debugger = std::make_unique<Debugger<CPU<Config>>>(cpu, program);
+        for (uint16_t pc = 0; pc < program.size(); ++pc) {
+          debugger->set_breakpoint(pc, [](const CPU<Config> &) { return false; });
+        }
+      }
+      debugger->run(1);
+    }
+    bool comparable(const CPU<Config> &, bool) const { return true; }
+    CPUState<Config> save() const { return cpu.save(); }
+
+  private:
+    CPU<Config> cpu;
+    std::unique_ptr<Debugger<CPU<Config>>> debugger;
+  };
+
+  // 1コア・1命令の量子で MultiCore を動かし、毎命令コアの写しから共有 RAM / 出力ポートへの反映を通す
+  // （比べるのはコアの写しではなく共有側の RAM / ポート）
+  class MultiCoreEngine {
+  public:
+    void restore(const CPUState<Config> &state) {
+      start = state;
+      machine.reset();
+    }
+    void set_input(uint8_t port, uint8_t value) { (machine ? machine->in_ports : start.in_ports)[port] = value; }
+    void advance(const Program &program, const CPU<Config> &) {
+      if (!machine) {
+        machine = std::make_unique<MultiCore<Config>>(program, typename MultiCore<Config>::Options{1, 1, 0, 1});
+        machine->core(0).restore(start);
+        machine->ram = start.ram;
+        machine->in_ports = start.in_ports;
+        machine->out_ports = start.out_ports;
+      }
+      machine->run(1);
+    }
+    bool comparable(const CPU<Config> &, bool) const { return true; }
+    CPUState<Config> save() const {
+      if (!machine) {
+        return start;
+      }
+      CPUState<Config> state = machine->core(0).save();
+      state.ram = machine->ram;
+      state.in_ports = machine->in_ports;
+      state.out_ports = machine->out_ports;
+      return state;
+    }
+
+  private:
+    CPUState<Config> start;
+    std::unique_ptr<MultiCore<Config>> machine;
+  };
+
+  using Engines = std::tuple<CPU<Config>, LockstepEngine<CPU<Config, GateALUEngine<Config>>>, MemoEngine, TrapEngine, MultiCoreEngine>;
+  static constexpr const char* EngineNames[] = {"reference", "gate-level", "memoized", "trap", "multicore"};
+  static constexpr uint64_t MaxSteps = 512;
+
+  static FuzzCase<Config> generate(uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    auto pick = [&rng](uint32_t n) { return static_cast<uint8_t>(rng() % n); };
+
+    FuzzCase<Config> fc;
+    size_t length = 4 + rng() % 40;
+    for (size_t i = 0; i + 1 < length; ++i) {
+      Instruction inst;
+      uint32_t roll = pick(100);
+      // ALU 命令を多めに、制御フローは少なめに生成
+      if (roll < 35) {
+        inst.kind = InstKind::ALU;
+        inst.alu_op = static_cast<Opcode>(pick(8));
+      } else if (roll < 80) {
+        static constexpr InstKind data_kinds[] = {
+          InstKind::CMP, InstKind::ADI, InstKind::SBI, InstKind::ANI, InstKind::CMI, InstKind::LDI, InstKind::MOV,
+          InstKind::API, InstKind::APD, InstKind::MLD, InstKind::MST, InstKind::PLD, InstKind::PST, InstKind::NOP
+        };
+        inst.kind = data_kinds[pick(sizeof(data_kinds) / sizeof(data_kinds[0]))];
+      } else {
+        static constexpr InstKind flow_kinds[] = {
+          InstKind::JMP, InstKind::BRH, InstKind::BRH, InstKind::CAL, InstKind::RET, InstKind::PSH, InstKind::POP
+        };
+        inst.kind = flow_kinds[pick(sizeof(flow_kinds) / sizeof(flow_kinds[0]))];
+      }
+      bool ap_a = inst.kind == InstKind::API;
+      bool ap_b = inst.kind == InstKind::MLD || inst.kind == InstKind::MST || inst.kind == InstKind::PLD || inst.kind == InstKind::PST;
+      inst.a = inst.kind == InstKind::BRH ? pick(4) : pick(ap_a ? Config::ApCount : Config::RegCount);
+      switch (inst.kind) {
+        case InstKind::ADI:
+        case InstKind::SBI:
+        case InstKind::ANI:
+        case InstKind::CMI:
+        case InstKind::LDI:
+        case InstKind::API:
+          inst.b = pick(256);
+          break;
+        default:
+          inst.b = pick(ap_b ? Config::ApCount : Config::RegCount);
+          break;
+      }
+      inst.c = ap_b ? pick(16) : pick(inst.kind == InstKind::APD ? Config::ApCount : Config::RegCount);
+      inst.addr = static_cast<uint16_t>(rng() % length);
+      fc.program.push_back(inst);
+    }
+    fc.program.push_back({InstKind::HLT});
+
+    CPUState<Config> &st = fc.start;
+    for (auto &v : st.regs) v = pick(256);
+    for (auto &v : st.aps) v = pick(256);
+    for (auto &v : st.ram) v = pick(256);
+    for (auto &v : st.in_ports) v = pick(256);
+    st.regs[0] = 0;
+    st.aps[0] = 0;
+    st.flags = pick(64);
+
+    size_t event_count = pick(5);
+    for (size_t i = 0; i < event_count; ++i) {
+      fc.events.push_back({static_cast<uint32_t>(rng() % MaxSteps), pick(Config::PortCount), pick(256)});
+    }
+    std::sort(fc.events.begin(), fc.events.end(), [](const PortEvent &x, const PortEvent &y) { return x.step < y.step; });
+    return fc;
+  }
+
+  // 全エンジンが一致すれば true。食い違った場合は report に内容を書く
+  static bool check(const FuzzCase<Config> &fc, std::string *report = nullptr) {
+    auto engines = std::make_unique<Engines>();
+    auto &reference = std::get<0>(*engines);
+    reference.restore(fc.start);
+    each_engine(*engines, [&fc](auto &engine) { engine.restore(fc.start); });
+
+    size_t next_event = 0;
+    for (uint64_t step = 0; step < MaxSteps && !reference.halted; ++step) {
+      for (; next_event < fc.events.size() && fc.events[next_event].step == step; ++next_event) {
+        const PortEvent &ev = fc.events[next_event];
+        reference.in_ports[ev.port] = ev.value;
+        each_engine(*engines, [&ev](auto &engine) { engine.set_input(ev.port, ev.value); });
+      }
+      bool block_end = reference.pc < fc.program.size() && is_block_end(fc.program[reference.pc]);
+      reference.step(fc.program);
+      each_engine(*engines, [&](auto &engine) { engine.advance(fc.program, reference); });
+      if ((block_end || reference.halted) && !agree(*engines, step, false, report)) {
+        return false;
+      }
+    }
+    return agree(*engines, MaxSteps, true, report);
+  }
+
+  // NOP を取り除いて命令を詰め、飛び先を付け替える（keep[i] が false の命令を消す）
+  // 消した命令への飛び先は、その後ろで最初に残る命令へ（NOP は次へ進むだけなので動作は変わらない）
+  static FuzzCase<Config> compact(const FuzzCase<Config> &fc, const std::vector<bool> &keep) {
+    std::vector<uint16_t> moved(fc.program.size() + 1);
+    FuzzCase<Config> result = fc;
+    result.program.clear();
+    for (size_t i = 0; i < fc.program.size(); ++i) {
+      moved[i] = static_cast<uint16_t>(result.program.size());
+      if (keep[i]) {
+        result.program.push_back(fc.program[i]);
+      }
+    }
+    moved[fc.program.size()] = static_cast<uint16_t>(result.program.size());
+    for (Instruction &inst : result.program) {
+      if (inst.kind == InstKind::JMP || inst.kind == InstKind::BRH || inst.kind == InstKind::CAL) {
+        inst.addr = moved[std::min<size_t>(inst.addr, fc.program.size())];
+      }
+    }
+    result.start.pc = moved[std::min<size_t>(fc.start.pc, fc.program.size())];
+    return result;
+  }
+
+  // 食い違いを保ったまま命令を NOP に置き換え、入力イベントと初期状態を単純化する
+  // 最後に NOP を取り除いてアドレスを詰める（実行する命令数が変わるので、食い違いが残るものだけ）
+  static FuzzCase<Config> minimize(FuzzCase<Config> fc) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t chunk = fc.program.size() / 2; chunk >= 1; chunk /= 2) {
+        for (size_t begin = 0; begin + 1 < fc.program.size(); begin += chunk) {
+          FuzzCase<Config> candidate = fc;
+          bool any = false;
+          for (size_t i = begin; i < std::min(begin + chunk, fc.program.size() - 1); ++i) {
+            any |= candidate.program[i].kind != InstKind::NOP;
+            candidate.program[i] = Instruction{};
+          }
+          if (any && !check(candidate)) {
+            fc = candidate;
+            changed = true;
+          }
+        }
+      }
+      for (size_t i = 0; i < fc.events.size(); ++i) {
+        FuzzCase<Config> candidate = fc;
+        candidate.events.erase(candidate.events.begin() + i);
+        if (!check(candidate)) {
+          fc = candidate;
+          changed = true;
+          --i;
+        }
+      }
+      FuzzCase<Config> candidate = fc;
+      candidate.start.ram.fill(0);
+      candidate.start.in_ports.fill(0);
+      if (candidate.start != fc.start && !check(candidate)) {
+        fc = candidate;
+        changed = true;
+      }
+      for (size_t i = 0; i < Config::RegCount; ++i) {
+        candidate = fc;
+        candidate.start.regs[i] = 0;
+        if (candidate.start != fc.start && !check(candidate)) {
+          fc = candidate;
+          changed = true;
+        }
+      }
+    }
+    // まとめて詰められなければ、後ろの NOP から1つずつ試す
+    std::vector<bool> keep(fc.program.size());
+    for (size_t i = 0; i < fc.program.size(); ++i) {
+      keep[i] = fc.program[i].kind != InstKind::NOP;
+    }
+    FuzzCase<Config> packed = compact(fc, keep);
+    if (!check(packed)) {
+      return packed;
+    }
+    for (size_t i = fc.program.size(); i-- > 0;) {
+      if (fc.program[i].kind != InstKind::NOP) {
+        continue;
+      }
+      keep.assign(fc.program.size(), true);
+      keep[i] = false;
+      FuzzCase<Config> candidate = compact(fc, keep);
+      if (!check(candidate)) {
+        fc = candidate;
+      }
+    }
+    return fc;
+  }
+
+  static void print_case(const FuzzCase<Config> &fc) {
+    std::cout << Colors::BOLD << "Program (NOP omitted):" << Colors::RESET << std::endl;
+    for (size_t i = 0; i < fc.program.size(); ++i) {
+      if (fc.program[i].kind != InstKind::NOP) {
+        std::cout << "  " << std::setw(4) << i << ": " << disassemble(fc.program[i]) << std::endl;
+      }
+    }
+    std::cout << Colors::BOLD << "Start state:" << Colors::RESET << std::endl << " ";
+    for (size_t i = 0; i < Config::RegCount; ++i) {
+      std::cout << " r" << i << "=" << +fc.start.regs[i];
+    }
+    std::cout << "\n  flags=0x" << std::hex << +fc.start.flags << std::dec << std::endl;
+    for (const PortEvent &ev : fc.events) {
+      std::cout << "  input event: step " << ev.step << ", port " << +ev.port << " <- " << +ev.value << std::endl;
+    }
+  }
+
+  // 全コアでテストケースを生成・実行。食い違いがなければ true
+  static bool run(uint64_t cases, double seconds, uint64_t seed, unsigned threads) {
+    std::cout << Colors::CYAN << Colors::BOLD << "\n==== DIFFERENTIAL FUZZING (config: " << Config::Name << ") ====" << Colors::RESET << std::endl;
+    std::cout << "Engines:";
+    for (const char* name : EngineNames) {
+      std::cout << " " << name;
+    }
+    std::cout << ", threads: " << threads << ", seed: " << seed << std::endl;
+
+    std::atomic<uint64_t> next_case{0};
+    std::atomic<uint64_t> done{0};
+    std::atomic<bool> failed{false};
+    std::mutex failure_mutex;
+    uint64_t failing_seed = 0;
+    std::string failure;
+    auto start = std::chrono::steady_clock::now();
+
+    auto worker = [&] {
+      while (!failed.load(std::memory_order_relaxed)) {
+        uint64_t index = next_case.fetch_add(1, std::memory_order_relaxed);
+        if (index >= cases) {
+          break;
+        }
+        if (seconds > 0 && (index & 1023) == 0 &&
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= seconds) {
+          break;
+        }
+        uint64_t case_seed = mix(seed + index);
+        std::string report;
+        if (!check(generate(case_seed), &report)) {
+          std::lock_guard<std::mutex> lock(failure_mutex);
+          if (!failed.exchange(true)) {
+            failing_seed = case_seed;
+            failure = report;
+          }
+        }
+        done.fetch_add(1, std::memory_order_relaxed);
+      }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+      pool.emplace_back(worker);
+    }
+    for (std::thread &th : pool) {
+      th.join();
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << done.load() << " programs in " << std::fixed << std::setprecision(2) << elapsed << "s ("
+              << std::setprecision(0) << done.load() / std::max(elapsed, 1e-9) * 3600.0 << " programs/hour)"
+              << std::defaultfloat << std::endl;
+
+    if (!failed) {
+      std::cout << std::endl << Colors::GREEN << Colors::BOLD << "✓ All engines agree." << Colors::RESET << std::endl;
+      return true;
+    }
+    std::cout << std::endl << Colors::YELLOW << Colors::BOLD << "✗ Engines disagree (case seed " << failing_seed << "): "
+              << failure << Colors::RESET << std::endl;
+    FuzzCase<Config> minimal = minimize(generate(failing_seed));
+    std::string minimal_report;
+    check(minimal, &minimal_report);
+    std::cout << Colors::DIM << "Minimized: " << minimal_report << Colors::RESET << std::endl;
+    print_case(minimal);
+    return false;
+  }
+
+private:
+  static uint64_t mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+  }
+
+  // 参照以外の各エンジンに f を適用
+  template <typename F>
+  static void each_engine(Engines &engines, F &&f) {
+    std::apply([&f](auto &, auto &...engine) { (f(engine), ...); }, engines);
+  }
+
+  // final: MaxSteps まで実行し終えた（または参照が停止した）後の比較
+  static bool agree(Engines &engines, uint64_t step, bool final, std::string *report) {
+    const CPU<Config> &reference = std::get<0>(engines);
+    CPUState<Config> expected = reference.save();
+    bool ok = true;
+    size_t index = 0;
+    each_engine(engines, [&](const auto &engine) {
+      ++index;
+      ok = ok && (!engine.comparable(reference, final) || same_state(expected, engine.save(), EngineNames[index], step, report));
+    });
+    return ok;
+  }
+
+  static bool same_state(const CPUState<Config> &expected, const CPUState<Config> &actual, const char* engine, uint64_t step, std::string *report) {
+    if (expected == actual) {
+      return true;
+    }
+    if (report) {
+      std::ostringstream out;
+      out << engine << " differs from " << EngineNames[0] << " after step " << step << " (pc " << expected.pc << "):";
+      for (size_t i = 0; i < Config::RegCount; ++i) {
+        if (expected.regs[i] != actual.regs[i]) out << " r" << i << " " << +expected.regs[i] << "/" << +actual.regs[i];
+      }
+      for (size_t i = 0; i < Config::ApCount; ++i) {
+        if (expected.aps[i] != actual.aps[i]) out << " ap" << i << " " << +expected.aps[i] << "/" << +actual.aps[i];
+      }
+      for (size_t i = 0; i < Config::RAMSize; ++i) {
+        if (expected.ram[i] != actual.ram[i]) out << " ram[" << i << "] " << +expected.ram[i] << "/" << +actual.ram[i];
+      }
+      for (size_t i = 0; i < Config::PortCount; ++i) {
+        if (expected.out_ports[i] != actual.out_ports[i]) out << " out[" << i << "] " << +expected.out_ports[i] << "/" << +actual.out_ports[i];
+      }
+      if (expected.flags != actual.flags) out << " flags 0x" << std::hex << +expected.flags << "/0x" << +actual.flags << std::dec;
+      if (expected.pc != actual.pc) out << " pc " << expected.pc << "/" << actual.pc;
+      if (expected.halted != actual.halted) out << " halted " << expected.halted << "/" << actual.halted;
+      if (!(expected.call_stack == actual.call_stack)) out << " CALstack";
+      if (!(expected.gpr_stack == actual.gpr_stack)) out << " GPRstack";
+      *report = out.str();
+    }
+    return false;
+  }
+};
+
+// コマンドライン引数の数値。全体が数として読めて min〜max に収まらなければ異常終了する
+uint64_t parse_count(const std::string &option, const std::string &text, uint64_t min, uint64_t max = UINT64_MAX, int base = 10) {
+  size_t used = 0;
+  uint64_t n = 0;
+  try {
+    // stoull は "-1" を巨大な値として受け付けるので、符号は先に弾く
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) throw std::invalid_argument(text);
+    n = std::stoull(text, &used, base);
+  } catch (const std::exception &) {
+    used = 0;
+  }
+  if (used != text.size() || used == 0 || n < min || n > max) {
+    std::cerr << "Error: " << option << " expects an integer ";
+    if (max == UINT64_MAX) {
+      std::cerr << ">= " << min;
+    } else {
+      std::cerr << "in " << min << "-" << max;
+    }
+    std::cerr << ", got '" << text << "'. Terminate." << std::endl;
+    exit(1);
+  }
+  return n;
+}
+
+double parse_number(const std::string &option, const std::string &text, double min) {
+  size_t used = 0;
+  double x = 0.0;
+  try {
+    x = std::stod(text, &used);
+  } catch (const std::exception &) {
+    used = 0;
+  }
+  if (used != text.size() || used == 0 || !std::isfinite(x) || x < min) {
+    std::cerr << "Error: " << option << " expects a number >= " << min << ", got '" << text << "'. Terminate." << std::endl;
+    exit(1);
+  }
+  return x;
+}
+
+// テスト（--config demo|spec|fast で構成を選択）
+int main(int argc, char *argv[]) {
+  Helper run;
+  std::string config_name = CPUConfig::Demo::Name;
+  bool config_given = false;
+  bool bench_mode = false;
+  std::string bench_out;
+  std::string compare_old;
+  std::string compare_new;
+  double threshold = 10.0;
+  bool fuzz_mode = false;
+  uint64_t fuzz_cases = 100000;
+  double fuzz_seconds = 0.0;
+  uint64_t fuzz_seed = 1;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  bool dashboard_mode = false;
+  bool sweep_mode = false;
+  bool superopt_mode = false;
+  size_t max_length = 4;
+  std::string rules_out;
+  uint64_t slice_begin = 0;
+  uint64_t slice_end = UINT64_MAX;
+  std::string golden;
+  std::string write_golden;
+  std::string profile_out;
+  std::string branch_profile;
+  std::string locations_file;
+  std::string rom_file;
+  std::vector<uint8_t> input_ports = {0, 1};
+  bool multicore_mode = false;
+  MultiCore<CPUConfig::Fast>::Options multicore;
+  double fps = 20.0;
+  double dashboard_seconds = 10.0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--config" && i + 1 < argc) {
+      config_name = argv[++i];
+      config_given = true;
+    } else if (arg == "--bench") {
+      bench_mode = true;
+    } else if (arg == "--out" && i + 1 < argc) {
+      bench_out = argv[++i];
+    } else if (arg == "--compare" && i + 2 < argc) {
+      compare_old = argv[++i];
+      compare_new = argv[++i];
+    } else if (arg == "--threshold" && i + 1 < argc) {
+      threshold = parse_number(arg, argv[++i], 0.0);
+    } else if (arg == "--profile-out" && i + 1 < argc) {
+      profile_out = argv[++i];
+    } else if (arg == "--branch-profile" && i + 1 < argc) {
+      branch_profile = argv[++i];
+    } else if (arg == "--locations" && i + 1 < argc) {
+      locations_file = argv[++i];
+    } else if (arg == "--rom" && i + 1 < argc) {
+      rom_file = argv[++i];
+    } else if (arg == "--inputs" && i + 1 < argc) {
+      input_ports.clear();
+      std::istringstream list(argv[++i]);
+      for (std::string port; std::getline(list, port, ',');) {
+        input_ports.push_back(static_cast<uint8_t>(parse_count(arg, port, 0, CPUConfig::Fast::PortCount - 1)));
+      }
+    } else if (arg == "--superopt") {
+      superopt_mode = true;
+    } else if (arg == "--max-length" && i + 1 < argc) {
+      max_length = parse_count(arg, argv[++i], 1, Superoptimizer::MaxLength);
+    } else if (arg == "--rules" && i + 1 < argc) {
+      rules_out = argv[++i];
+    } else if (arg == "--sweep") {
+      sweep_mode = true;
+    } else if (arg == "--slice" && i + 2 < argc) {
+      slice_begin = parse_count(arg, argv[++i], 0, UINT64_MAX, 0);
+      slice_end = parse_count(arg, argv[++i], 0, UINT64_MAX, 0);
+    } else if (arg == "--golden" && i + 1 < argc) {
+      golden = argv[++i];
+    } else if (arg == "--write-golden" && i + 1 < argc) {
+      write_golden = argv[++i];
+    } else if (arg == "--multicore") {
+      multicore_mode = true;
+    } else if (arg == "--cores" && i + 1 < argc) {
+      multicore.cores = parse_count(arg, argv[++i], 1, 256);
+    } else if (arg == "--quantum" && i + 1 < argc) {
+      multicore.quantum = parse_count(arg, argv[++i], 1);
+    } else if (arg == "--mem-latency" && i + 1 < argc) {
+      multicore.mem_latency = static_cast<uint32_t>(parse_count(arg, argv[++i], 0, UINT32_MAX));
+    } else if (arg == "--dashboard") {
+      dashboard_mode = true;
+    } else if (arg == "--fps" && i + 1 < argc) {
+      fps = parse_number(arg, argv[++i], 1.0);
+    } else if (arg == "--duration" && i + 1 < argc) {
+      dashboard_seconds = parse_number(arg, argv[++i], 0.0);
+    } else if (arg == "--fuzz") {
+      fuzz_mode = true;
+    } else if (arg == "--cases" && i + 1 < argc) {
+      fuzz_cases = parse_count(arg, argv[++i], 0);
+    } else if (arg == "--seconds" && i + 1 < argc) {
+      fuzz_seconds = parse_number(arg, argv[++i], 0.0);
+    } else if (arg == "--seed" && i + 1 < argc) {
+      fuzz_seed = parse_count(arg, argv[++i], 0, UINT64_MAX, 0);
+    } else if (arg == "--threads" && i + 1 < argc) {
+      threads = static_cast<unsigned>(parse_count(arg, argv[++i], 1, 1024));
+    } else {
+      // 綴りの誤りや値のないオプションを黙って無視すると、意図しないモード（部品テストなど）が走る
+      std::cerr << "Error: Unknown option or missing value: " << arg << ". Terminate." << std::endl;
+      return 1;
+    }
+  }
+
+  // 部品テスト以外のモードは fast 構成で実装している（遅延ありの構成では実用にならない）
+  const char *fast_only = fuzz_mode ? "--fuzz" : superopt_mode ? "--superopt" : !branch_profile.empty() ? "--branch-profile"
+                        : sweep_mode ? "--sweep" : multicore_mode ? "--multicore" : dashboard_mode ? "--dashboard"
+                        : !compare_old.empty() ? "--compare" : bench_mode ? "--bench" : nullptr;
+  if (fast_only && config_given && config_name != CPUConfig::Fast::Name) {
+    std::cerr << "Error: " << fast_only << " always runs the " << CPUConfig::Fast::Name << " configuration; --config "
+              << config_name << " is not supported. Terminate." << std::endl;
+    return 1;
+  }
+
+  if (fuzz_mode) {
+    return DifferentialFuzzer<CPUConfig::Fast>::run(fuzz_cases, fuzz_seconds, fuzz_seed, threads) ? 0 : 1;
+  }
+
+#ifdef CPUVM_PROFILE
+  // どのモードで終了しても、最後に集計を表示して trace を書き出す
+  struct ProfileReport {
+    std::string path;
+    ~ProfileReport() {
+      HostProfile::Registry::instance().print_summary();
+      if (!path.empty()) {
+        HostProfile::Registry::instance().write_chrome_trace(path);
+        std::cout << Colors::DIM << "Chrome trace written to " << path << Colors::RESET << std::endl;
+      }
+    }
+  } profile_report{profile_out};
+#else
+  if (!profile_out.empty()) {
+    std::cerr << "Warning: --profile-out requires a build with -DCPUVM_PROFILE; no profile written." << std::endl;
+  }
+#endif
+
+  if (superopt_mode) {
+    std::cout << Colors::CYAN << Colors::BOLD << "\n==== SUPEROPTIMIZER (max length " << max_length << ", threads " << threads << ") ====" << Colors::RESET << std::endl;
+    Superoptimizer superopt(threads);
+    std::vector<std::string> rules;
+    for (const auto &target : Superoptimizer::builtin_targets()) {
+      if (!Superoptimizer::verify(target.naive, target.f)) {
+        std::cerr << "Error: Naive sequence for " << target.name << " is wrong. Terminate." << std::endl;
+        exit(1);
+      }
+      auto start = std::chrono::steady_clock::now();
+      size_t length = std::min({max_length, target.naive.size() - 1, Superoptimizer::MaxLength});
+      auto result = superopt.search(target, length);
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cout << Colors::YELLOW << target.name << Colors::RESET << ": naive " << target.naive.size() << " -> ";
+      if (result.sequences.empty() && length < target.naive.size() - 1) {
+        std::cout << "none up to length " << length; // もっと長い命令列は探していない
+      } else if (result.sequences.empty()) {
+        std::cout << "no shorter sequence";
+      } else {
+        std::cout << result.sequences.front().size() << " (" << result.sequences.size() << " found)";
+        rules.push_back(Superoptimizer::rule(target, result.sequences.front()));
+      }
+      std::cout << Colors::DIM << "  [" << result.candidates << " candidates, " << result.verified << " verified, "
+                << std::fixed << std::setprecision(2) << elapsed << "s]" << std::defaultfloat << Colors::RESET << std::endl;
+      if (!result.sequences.empty()) {
+        for (const Instruction &inst : result.sequences.front()) {
+          std::cout << "    " << disassemble(inst) << "\n";
+        }
+      }
+    }
+    std::ostringstream js;
+    js << "// CPUVM --superopt が生成 (PEEPHOLE_RULES に追加する)\nexport const SUPEROPT_RULES = [\n";
+    for (const std::string &r : rules) {
+      js << r << "\n";
+    }
+    js << "];\n";
+    if (rules_out.empty()) {
+      std::cout << std::endl << js.str();
+    } else {
+      std::ofstream out(rules_out);
+      if (!out || !(out << js.str()) || !out.flush()) {
+        std::cerr << "Error: Cannot write " << rules_out << ". Terminate." << std::endl;
+        exit(1);
+      }
+      std::cout << std::endl << Colors::DIM << "Rules written to " << rules_out << Colors::RESET << std::endl;
+    }
+    return 0;
+  }
+
+  // --sweep / --branch-profile で実行するプログラム（--rom がなければデモ用プログラム）
+  Program sweep_rom = rom_file.empty() ? sweep_demo_program() : read_rom(rom_file);
+
+  if (!branch_profile.empty()) {
+    const Program &rom = sweep_rom;
+    InputSweep<CPUConfig::Fast> sweep(rom, input_ports);
+    std::vector<std::string> locations;
+    if (!locations_file.empty()) {
+      locations = BranchProfile::read_locations(locations_file);
+    }
+    BranchProfile profile = sweep.profile(slice_begin, slice_end, threads);
+    profile.print(rom, locations);
+    // 既存の profile.json があれば "branches" だけを差し替える（§6.6 の "calls" を消さない）
+    std::string existing;
+    if (std::ifstream in{branch_profile}) {
+      std::ostringstream text;
+      text << in.rdbuf();
+      existing = text.str();
+    }
+    auto json = profile.to_json(rom, locations, existing);
+    if (!json) {
+      std::cerr << "Error: " << branch_profile << " is not a JSON object; not overwriting it. Terminate." << std::endl;
+      exit(1);
+    }
+    std::ofstream out(branch_profile);
+    if (!out || !(out << *json) || !out.flush()) {
+      std::cerr << "Error: Cannot write " << branch_profile << ". Terminate." << std::endl;
+      exit(1);
+    }
+    std::cout << Colors::DIM << "Branch profile (" << profile.flushes() << " taken branches) written to " << branch_profile << Colors::RESET << std::endl;
+    return 0;
+  }
+
+  if (sweep_mode) {
+    InputSweep<CPUConfig::Fast> sweep(sweep_rom, input_ports);
+    if (!write_golden.empty()) {
+      sweep.write_golden(write_golden, slice_begin, slice_end);
+      std::cout << Colors::DIM << "Golden file written to " << write_golden << Colors::RESET << std::endl;
+      return 0;
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::vector<InputSweep<CPUConfig::Fast>::Mismatch> mismatches;
+    if (golden.empty()) {
+      // 参照関数はデモ用プログラムのもの
+      if (!rom_file.empty()) {
+        std::cerr << "Error: --sweep --rom needs --golden or --write-golden. Terminate." << std::endl;
+        exit(1);
+      }
+      mismatches = sweep.run(slice_begin, slice_end, threads, sweep_demo_reference);
+    } else {
+      auto expected = sweep.read_golden(golden);
+      uint64_t first = std::max(slice_begin, expected.empty() ? 0 : expected.begin()->first);
+      uint64_t last = std::min(slice_end, expected.empty() ? 0 : expected.rbegin()->first + 1);
+      mismatches = sweep.run(first, last, threads, [&](uint64_t index) {
+        auto it = expected.find(index);
+        return it == expected.end() ? OutputTrace{} : it->second;
+      });
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Sweep finished in " << std::fixed << std::setprecision(3) << elapsed << "s" << std::defaultfloat
+              << " (" << sweep.startup_steps() << " startup steps skipped per case), " << mismatches.size() << " mismatches" << std::endl;
+    for (size_t k = 0; k < std::min<size_t>(mismatches.size(), 10); ++k) {
+      const auto &m = mismatches[k];
+      std::cout << "  expected " << sweep.format_line(m.index, m.expected) << "\n       got " << sweep.format_line(m.index, m.actual) << "\n";
+    }
+    return mismatches.empty() ? 0 : 1;
+  }
+
+  if (multicore_mode) {
+    multicore.threads = threads;
+    MultiCore<CPUConfig::Fast> machine(multicore_demo_program(), multicore);
+    machine.run(1000000);
+    std::cout << "ram[0] = " << +machine.ram[0] << std::endl;
+    machine.print_report();
+    return 0;
+  }
+
+  if (dashboard_mode) {
+    using Config = CPUConfig::Fast;
+    auto cpu = std::make_unique<CPU<Config>>();
+    SeqLock<MonitorSample<Config>> monitor;
+    Program rom = dashboard_demo_program();
+    Dashboard<Config> dashboard(monitor, fps);
+    dashboard.start();
+    auto start = std::chrono::steady_clock::now();
+    while (!cpu->halted && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < dashboard_seconds) {
+      cpu->run(rom, 1 << 22, monitor);
+    }
+    dashboard.stop();
+    return 0;
+  }
+
+  if (!compare_old.empty()) {
+    return COMPARE_BENCHMARKS(compare_old, compare_new, threshold) == 0 ? 0 : 1;
+  }
+  if (bench_mode) {
+    Bench bench;
+    BENCHMARKS(bench);
+    if (!bench_out.empty()) {
+      bench.write_json(bench_out);
+      std::cout << std::endl << Colors::DIM << "Results written to " << bench_out << Colors::RESET << std::endl;
+    }
+    return 0;
+  }
   
   std::cout << Colors::BOLD << Colors::CYAN << "\nCPU Component Test Suite" << Colors::RESET << std::endl;
   std::cout << Colors::DIM << "Testing ALU and Register implementations..." << Colors::RESET << std::endl;
   std::cout << std::string(50, '=') << std::endl;
 
-  ALU_TESTS(run);
+  bool passed = true;
+  passed = GATE_TESTS(run) && passed;
+  std::cout << std::endl;
+
+  passed = DEBUGGER_TESTS(run) && passed;
+  std::cout << std::endl;
+
+  passed = MULTICORE_TESTS(run) && passed;
+  std::cout << std::endl;
+
+  passed = SWEEP_TESTS(run) && passed;
   std::cout << std::endl;
-  run.halt(1.0);
 
-  REG_TESTS(run);
+  passed = MEMO_TESTS(run) && passed;
   std::cout << std::endl;
-  run.Halt(1.0);
 
-  COMBINED_TESTS(run);
+  passed = BRANCH_PROFILE_TESTS(run) && passed;
   std::cout << std::endl;
-  run.halt(1.0);
+
+  passed = SUPEROPT_TESTS(run) && passed;
+  std::cout << std::endl;
+
+  bool found = with_config(config_name, [&run, &passed](auto config) {
+    using Config = decltype(config);
+    std::cout << Colors::DIM << "Config: " << Config::Name << Colors::RESET << std::endl;
+    double pause = Config::UseDelay ? 1.0 : 0.0;
+
+    passed = ALU_TESTS<Config>(run) && passed;
+    std::cout << std::endl;
+    run.halt(pause);
+
+    passed = REG_TESTS<Config>(run) && passed;
+    std::cout << std::endl;
+    run.halt(pause);
+
+    passed = COMBINED_TESTS<Config>(run) && passed;
+    std::cout << std::endl;
+    run.halt(pause);
+  });
+  if (!found) {
+    std::cerr << "Error: Unknown config '" << config_name << "'. Use demo, spec or fast." << std::endl;
+    return 1;
+  }
   
   std::cout << std::string(50, '=') << std::endl;
+  if (!passed) {
+    std::cout << Colors::YELLOW << Colors::BOLD << run.failures << " checks failed." << Colors::RESET << std::endl;
+    return 1;
+  }
   std::cout << Colors::GREEN << Colors::BOLD << "All tests completed successfully!" << Colors::RESET << std::endl;
   std::cout << Colors::DIM << "CPU components are working correctly." << Colors::RESET << std::endl;
 